@@ -0,0 +1,475 @@
+
+#include <cmath>
+#include "batch.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define SCV_BATCH_X86
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define SCV_FORCE_INLINE    inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+    #define SCV_FORCE_INLINE    __forceinline
+#else
+    #define SCV_FORCE_INLINE    inline
+#endif
+
+#if defined(SCV_BATCH_X86) && (defined(__GNUC__) || defined(__clang__))
+    // GCC and Clang only allow AVX2 intrinsics in functions marked for it, so that the rest of the
+    // program can still run on CPUs without AVX2. Everything below is force inlined into the marked
+    // function, so the kernel gets compiled with AVX2 enabled there (even in debug builds). SSE2 is
+    // always there on x64, but not on 32 bit x86.
+    #define SCV_TARGET_SSE2     __attribute__((target("sse2")))
+    #define SCV_TARGET_AVX2     __attribute__((target("avx2")))
+#else
+    #define SCV_TARGET_SSE2
+    #define SCV_TARGET_AVX2
+#endif
+
+namespace scv {
+
+// The coefficients and output pointers for one batch
+template <typename T>
+struct cubicBatch {
+    T c[4][3];      // [power][axis]
+    const T* t;
+    size_t n;
+    T* out[3][3];   // [derivative][axis], null if not wanted
+};
+
+// The inputs and outputs for one batch of move profiles
+template <typename T>
+struct profileBatch {
+    const T* length;
+    const T* vel;
+    const T* acc;
+    const T* jerk;
+    size_t n;
+    T* T1;
+    T* TL;
+    T* T2;
+};
+
+// Operations used by the kernels, one struct per instruction set. 'width' is the number
+// of values handled per instruction. A mask holds the result of a comparison for each value,
+// and select picks from 'a' where the mask is set and from 'b' elsewhere.
+template <typename T>
+struct scalarOps {
+    typedef T scalar;
+    typedef T reg;
+    typedef bool mask;
+    enum { width = 1 };
+    SCV_FORCE_INLINE static reg set1(T a)                { return a; }
+    SCV_FORCE_INLINE static reg load(const T* p)         { return *p; }
+    SCV_FORCE_INLINE static void store(T* p, reg a)      { *p = a; }
+    SCV_FORCE_INLINE static reg add(reg a, reg b)        { return a + b; }
+    SCV_FORCE_INLINE static reg sub(reg a, reg b)        { return a - b; }
+    SCV_FORCE_INLINE static reg mul(reg a, reg b)        { return a * b; }
+    SCV_FORCE_INLINE static reg div(reg a, reg b)        { return a / b; }
+    SCV_FORCE_INLINE static reg sqrt(reg a)              { return std::sqrt(a); }
+    SCV_FORCE_INLINE static mask cmpgt(reg a, reg b)     { return a > b; }
+    SCV_FORCE_INLINE static mask cmpge(reg a, reg b)     { return a >= b; }
+    SCV_FORCE_INLINE static mask cmpeq(reg a, reg b)     { return a == b; }
+    SCV_FORCE_INLINE static mask maskAnd(mask a, mask b) { return a && b; }
+    SCV_FORCE_INLINE static reg select(mask m, reg a, reg b) { return m ? a : b; }
+    SCV_FORCE_INLINE static int movemask(mask m)         { return m ? 1 : 0; }
+};
+
+#ifdef SCV_BATCH_X86
+
+struct sseFloatOps {
+    typedef float scalar;
+    typedef __m128 reg;
+    typedef __m128 mask;
+    enum { width = 4 };
+    SCV_FORCE_INLINE static reg set1(float a)            { return _mm_set1_ps(a); }
+    SCV_FORCE_INLINE static reg load(const float* p)     { return _mm_loadu_ps(p); }
+    SCV_FORCE_INLINE static void store(float* p, reg a)  { _mm_storeu_ps(p, a); }
+    SCV_FORCE_INLINE static reg add(reg a, reg b)        { return _mm_add_ps(a, b); }
+    SCV_FORCE_INLINE static reg sub(reg a, reg b)        { return _mm_sub_ps(a, b); }
+    SCV_FORCE_INLINE static reg mul(reg a, reg b)        { return _mm_mul_ps(a, b); }
+    SCV_FORCE_INLINE static reg div(reg a, reg b)        { return _mm_div_ps(a, b); }
+    SCV_FORCE_INLINE static reg sqrt(reg a)              { return _mm_sqrt_ps(a); }
+    SCV_FORCE_INLINE static mask cmpgt(reg a, reg b)     { return _mm_cmpgt_ps(a, b); }
+    SCV_FORCE_INLINE static mask cmpge(reg a, reg b)     { return _mm_cmpge_ps(a, b); }
+    SCV_FORCE_INLINE static mask cmpeq(reg a, reg b)     { return _mm_cmpeq_ps(a, b); }
+    SCV_FORCE_INLINE static mask maskAnd(mask a, mask b) { return _mm_and_ps(a, b); }
+    SCV_FORCE_INLINE static reg select(mask m, reg a, reg b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+    SCV_FORCE_INLINE static int movemask(mask m)         { return _mm_movemask_ps(m); }
+};
+
+struct sseDoubleOps {
+    typedef double scalar;
+    typedef __m128d reg;
+    typedef __m128d mask;
+    enum { width = 2 };
+    SCV_FORCE_INLINE static reg set1(double a)           { return _mm_set1_pd(a); }
+    SCV_FORCE_INLINE static reg load(const double* p)    { return _mm_loadu_pd(p); }
+    SCV_FORCE_INLINE static void store(double* p, reg a) { _mm_storeu_pd(p, a); }
+    SCV_FORCE_INLINE static reg add(reg a, reg b)        { return _mm_add_pd(a, b); }
+    SCV_FORCE_INLINE static reg sub(reg a, reg b)        { return _mm_sub_pd(a, b); }
+    SCV_FORCE_INLINE static reg mul(reg a, reg b)        { return _mm_mul_pd(a, b); }
+    SCV_FORCE_INLINE static reg div(reg a, reg b)        { return _mm_div_pd(a, b); }
+    SCV_FORCE_INLINE static reg sqrt(reg a)              { return _mm_sqrt_pd(a); }
+    SCV_FORCE_INLINE static mask cmpgt(reg a, reg b)     { return _mm_cmpgt_pd(a, b); }
+    SCV_FORCE_INLINE static mask cmpge(reg a, reg b)     { return _mm_cmpge_pd(a, b); }
+    SCV_FORCE_INLINE static mask cmpeq(reg a, reg b)     { return _mm_cmpeq_pd(a, b); }
+    SCV_FORCE_INLINE static mask maskAnd(mask a, mask b) { return _mm_and_pd(a, b); }
+    SCV_FORCE_INLINE static reg select(mask m, reg a, reg b) { return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b)); }
+    SCV_FORCE_INLINE static int movemask(mask m)         { return _mm_movemask_pd(m); }
+};
+
+struct avx2FloatOps {
+    typedef float scalar;
+    typedef __m256 reg;
+    typedef __m256 mask;
+    enum { width = 8 };
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static reg set1(float a)            { return _mm256_set1_ps(a); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static reg load(const float* p)     { return _mm256_loadu_ps(p); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static void store(float* p, reg a)  { _mm256_storeu_ps(p, a); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static reg add(reg a, reg b)        { return _mm256_add_ps(a, b); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static reg sub(reg a, reg b)        { return _mm256_sub_ps(a, b); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static reg mul(reg a, reg b)        { return _mm256_mul_ps(a, b); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static reg div(reg a, reg b)        { return _mm256_div_ps(a, b); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static reg sqrt(reg a)              { return _mm256_sqrt_ps(a); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static mask cmpgt(reg a, reg b)     { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static mask cmpge(reg a, reg b)     { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static mask cmpeq(reg a, reg b)     { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static mask maskAnd(mask a, mask b) { return _mm256_and_ps(a, b); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static reg select(mask m, reg a, reg b) { return _mm256_blendv_ps(b, a, m); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static int movemask(mask m)         { return _mm256_movemask_ps(m); }
+};
+
+struct avx2DoubleOps {
+    typedef double scalar;
+    typedef __m256d reg;
+    typedef __m256d mask;
+    enum { width = 4 };
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static reg set1(double a)           { return _mm256_set1_pd(a); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static reg load(const double* p)    { return _mm256_loadu_pd(p); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static void store(double* p, reg a) { _mm256_storeu_pd(p, a); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static reg add(reg a, reg b)        { return _mm256_add_pd(a, b); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static reg sub(reg a, reg b)        { return _mm256_sub_pd(a, b); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static reg mul(reg a, reg b)        { return _mm256_mul_pd(a, b); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static reg div(reg a, reg b)        { return _mm256_div_pd(a, b); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static reg sqrt(reg a)              { return _mm256_sqrt_pd(a); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static mask cmpgt(reg a, reg b)     { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static mask cmpge(reg a, reg b)     { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static mask cmpeq(reg a, reg b)     { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static mask maskAnd(mask a, mask b) { return _mm256_and_pd(a, b); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static reg select(mask m, reg a, reg b) { return _mm256_blendv_pd(b, a, m); }
+    SCV_TARGET_AVX2 SCV_FORCE_INLINE static int movemask(mask m)         { return _mm256_movemask_pd(m); }
+};
+
+#endif
+
+// The kernel is written once and stamped out for each instruction set, because GCC and Clang need
+// the target attribute to be on the function that the intrinsics end up in.
+#define SCV_CUBIC_BATCH_KERNEL(name, S, target)                                                             \
+target static void name(const cubicBatch<S::scalar>& b)                                                     \
+{                                                                                                           \
+    typedef S::scalar T;                                                                                    \
+    typedef S::reg reg;                                                                                     \
+                                                                                                            \
+    for (int k = 0; k < 3; k++) {                                                                           \
+        T c0 = b.c[0][k];                                                                                   \
+        T c1 = b.c[1][k];                                                                                   \
+        T c2 = b.c[2][k];                                                                                   \
+        T c3 = b.c[3][k];                                                                                   \
+        T* pos = b.out[0][k];                                                                               \
+        T* vel = b.out[1][k];                                                                               \
+        T* acc = b.out[2][k];                                                                               \
+                                                                                                            \
+        reg vc0 = S::set1(c0);                                                                              \
+        reg vc1 = S::set1(c1);                                                                              \
+        reg vc2 = S::set1(c2);                                                                              \
+        reg vc3 = S::set1(c3);                                                                              \
+        reg v2c2 = S::set1(2 * c2);                                                                         \
+        reg v3c3 = S::set1(3 * c3);                                                                         \
+        reg v6c3 = S::set1(6 * c3);                                                                         \
+                                                                                                            \
+        size_t i = 0;                                                                                       \
+        for (; i + S::width <= b.n; i += S::width) {                                                        \
+            reg t = S::load(b.t + i);                                                                       \
+            if ( pos )                                                                                      \
+                S::store(pos + i, S::add(vc0, S::mul(t, S::add(vc1, S::mul(t, S::add(vc2, S::mul(t, vc3))))))); \
+            if ( vel )                                                                                      \
+                S::store(vel + i, S::add(vc1, S::mul(t, S::add(v2c2, S::mul(t, v3c3)))));                  \
+            if ( acc )                                                                                      \
+                S::store(acc + i, S::add(v2c2, S::mul(t, v6c3)));                                           \
+        }                                                                                                   \
+                                                                                                            \
+        /* remainder that doesn't fill a whole register */                                                  \
+        for (; i < b.n; i++) {                                                                              \
+            T t = b.t[i];                                                                                   \
+            if ( pos )                                                                                      \
+                pos[i] = c0 + t * (c1 + t * (c2 + t * c3));                                                 \
+            if ( vel )                                                                                      \
+                vel[i] = c1 + t * (2 * c2 + t * (3 * c3));                                                  \
+            if ( acc )                                                                                      \
+                acc[i] = 2 * c2 + t * (6 * c3);                                                             \
+        }                                                                                                   \
+    }                                                                                                       \
+}
+
+// Overloads on the batch type pick the float or double version of each kernel
+typedef scalarOps<float> scalarFloatOps;
+typedef scalarOps<double> scalarDoubleOps;
+SCV_CUBIC_BATCH_KERNEL(evaluate_scalar, scalarFloatOps, )
+SCV_CUBIC_BATCH_KERNEL(evaluate_scalar, scalarDoubleOps, )
+
+#ifdef SCV_BATCH_X86
+SCV_CUBIC_BATCH_KERNEL(evaluate_sse, sseFloatOps, SCV_TARGET_SSE2)
+SCV_CUBIC_BATCH_KERNEL(evaluate_sse, sseDoubleOps, SCV_TARGET_SSE2)
+SCV_CUBIC_BATCH_KERNEL(evaluate_avx2, avx2FloatOps, SCV_TARGET_AVX2)
+SCV_CUBIC_BATCH_KERNEL(evaluate_avx2, avx2DoubleOps, SCV_TARGET_AVX2)
+#endif
+
+// Every lane works out all the cases of the profile and the masks pick the one that applies, which is
+// cheaper than branching when neighbouring moves take different cases. The operations are done in the
+// same order for every instruction set, so a move gets the same result whichever lane it ends up in.
+// Moves too short for both curves to finish are rare, so they are fixed up one at a time afterwards.
+// The number of moves must be a multiple of the register width.
+#define SCV_PROFILE_BATCH_KERNEL(name, S, target)                                                           \
+target static void name(const profileBatch<S::scalar>& b)                                                   \
+{                                                                                                           \
+    typedef S::scalar T;                                                                                    \
+    typedef S::reg reg;                                                                                     \
+    typedef S::mask mask;                                                                                   \
+                                                                                                            \
+    reg zero = S::set1((T)0);                                                                               \
+    reg one = S::set1((T)1);                                                                                \
+    reg minusOne = S::set1((T)-1);                                                                          \
+    reg half = S::set1((T)0.5);                                                                             \
+    reg minusHalf = S::set1((T)-0.5);                                                                       \
+    reg onePointFive = S::set1((T)1.5);                                                                     \
+    reg two = S::set1((T)2);                                                                                \
+    reg four = S::set1((T)4);                                                                               \
+    reg noSolution = S::set1((T)-99999);                                                                    \
+                                                                                                            \
+    for (size_t i = 0; i < b.n; i += S::width) {                                                            \
+        reg len = S::load(b.length + i);                                                                    \
+        reg v = S::load(b.vel + i);                                                                         \
+        reg a = S::load(b.acc + i);                                                                         \
+        reg j = S::load(b.jerk + i);                                                                        \
+        reg halfDistance = S::mul(half, len);                                                               \
+                                                                                                            \
+        /* full curves, reaching the acceleration limit */                                                  \
+        reg T1 = S::mul(half, S::div(S::mul(two, a), j));                                                   \
+        reg as = S::mul(j, T1);                                                                             \
+        reg dvInCurve = S::div(S::mul(a, a), S::mul(two, j));                                               \
+        reg v1 = dvInCurve;                                                                                 \
+        reg v2 = S::sub(v, dvInCurve);                                                                      \
+        mask over = S::cmpgt(v1, v2);                                                                       \
+        mask under = S::cmpgt(v2, v1);                                                                      \
+                                                                                                            \
+        /* curves shortened to meet at the speed limit */                                                   \
+        reg To = S::div(S::sqrt(S::mul(S::mul(four, v), j)), j);                                            \
+        reg T1o = S::div(S::mul(j, To), S::mul(two, j));                                                    \
+        reg T2o = S::sub(To, T1o);                                                                          \
+                                                                                                            \
+        /* constant acceleration between the curves, shortened if it would pass halfway. The distance to */ \
+        /* the end of the convex curve is 0.5*j*t*TL^2 + 1.5*j*t^2*TL + j*t^3, a quadratic in TL.        */ \
+        reg TL = S::div(S::sub(v2, v1), as);                                                                \
+        reg qa = S::mul(S::mul(half, j), T1);                                                               \
+        reg qb = S::mul(S::mul(S::mul(onePointFive, j), T1), T1);                                           \
+        reg bothCurves = S::mul(S::mul(S::mul(j, T1), T1), T1);                                             \
+        reg qc = S::sub(bothCurves, halfDistance);                                                          \
+        reg totalDistance = S::add(S::add(S::mul(S::mul(qa, TL), TL), S::mul(qb, TL)), bothCurves);         \
+                                                                                                            \
+        /* larger root of qa*TL^2 + qb*TL + qc = 0, as gsl_poly_solve_quadratic finds it */                 \
+        reg disc = S::sub(S::mul(qb, qb), S::mul(S::mul(four, qa), qc));                                    \
+        mask bZero = S::cmpeq(qb, zero);                                                                    \
+        reg rootNoB = S::sqrt(S::div(S::sub(zero, qc), qa));                                                \
+        reg sgnb = S::select(S::cmpgt(qb, zero), one, minusOne);                                            \
+        reg temp = S::mul(minusHalf, S::add(qb, S::mul(sgnb, S::sqrt(disc))));                              \
+        reg r1 = S::div(temp, qa);                                                                          \
+        reg r2 = S::div(qc, temp);                                                                          \
+        reg rootTwo = S::select(bZero, rootNoB, S::select(S::cmpgt(r2, r1), r2, r1));                       \
+        reg rootOne = S::div(S::mul(minusHalf, qb), qa);                                                    \
+        reg best = S::select(S::cmpgt(disc, zero), rootTwo,                                                 \
+                             S::select(S::cmpeq(disc, zero), rootOne, noSolution));                         \
+        reg rootLinear = S::div(S::sub(zero, qc), qb);                                                      \
+        rootLinear = S::select(S::cmpgt(noSolution, rootLinear), noSolution, rootLinear);                   \
+        rootLinear = S::select(bZero, noSolution, rootLinear);                                              \
+        best = S::select(S::cmpeq(qa, zero), rootLinear, best);                                             \
+                                                                                                            \
+        mask useRoot = S::maskAnd(S::maskAnd(under, S::cmpgt(totalDistance, halfDistance)), S::cmpge(best, zero)); \
+        TL = S::select(useRoot, best, TL);                                                                  \
+        TL = S::select(under, TL, zero);                                                                    \
+        reg T2 = S::select(over, T2o, T1);                                                                  \
+        T1 = S::select(over, T1o, T1);                                                                      \
+                                                                                                            \
+        /* too short for both curves, no constant acceleration or speed at all */                           \
+        mask tooShort = S::cmpgt(S::mul(S::mul(S::mul(j, T1), T1), T1), halfDistance);                      \
+        TL = S::select(tooShort, zero, TL);                                                                 \
+                                                                                                            \
+        S::store(b.T1 + i, T1);                                                                             \
+        S::store(b.TL + i, TL);                                                                             \
+        S::store(b.T2 + i, T2);                                                                             \
+                                                                                                            \
+        int shortLanes = S::movemask(tooShort);                                                             \
+        for (int k = 0; shortLanes; k++, shortLanes >>= 1) {                                                \
+            if ( shortLanes & 1 ) {                                                                         \
+                T hd = (T)0.5 * b.length[i + k];                                                            \
+                b.T1[i + k] = b.T2[i + k] = (T)std::cbrt(hd / b.jerk[i + k]);                               \
+            }                                                                                               \
+        }                                                                                                   \
+    }                                                                                                       \
+}
+
+SCV_PROFILE_BATCH_KERNEL(solveProfiles_scalar, scalarFloatOps, )
+SCV_PROFILE_BATCH_KERNEL(solveProfiles_scalar, scalarDoubleOps, )
+
+#ifdef SCV_BATCH_X86
+SCV_PROFILE_BATCH_KERNEL(solveProfiles_sse, sseFloatOps, SCV_TARGET_SSE2)
+SCV_PROFILE_BATCH_KERNEL(solveProfiles_sse, sseDoubleOps, SCV_TARGET_SSE2)
+SCV_PROFILE_BATCH_KERNEL(solveProfiles_avx2, avx2FloatOps, SCV_TARGET_AVX2)
+SCV_PROFILE_BATCH_KERNEL(solveProfiles_avx2, avx2DoubleOps, SCV_TARGET_AVX2)
+#endif
+
+static batchInstructionSet detectInstructionSet()
+{
+#if defined(SCV_BATCH_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    bool avx2 = false;
+    // the OS must also be saving the AVX registers on context switches
+    if ( maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6 ) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+    if ( avx2 )
+        return BIS_AVX2;
+    if ( sse2 )
+        return BIS_SSE;
+    return BIS_SCALAR;
+#elif defined(SCV_BATCH_X86)
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx2") )
+        return BIS_AVX2;
+    if ( __builtin_cpu_supports("sse2") )
+        return BIS_SSE;
+    return BIS_SCALAR;
+#else
+    return BIS_SCALAR;
+#endif
+}
+
+static const batchInstructionSet bestInstructionSet = detectInstructionSet();
+static batchInstructionSet currentInstructionSet = bestInstructionSet;
+
+batchInstructionSet getBatchInstructionSet()
+{
+    return currentInstructionSet;
+}
+
+void setBatchInstructionSet(batchInstructionSet bis)
+{
+    currentInstructionSet = bis < bestInstructionSet ? bis : bestInstructionSet;
+}
+
+template <typename T>
+void evaluateCubicBatch(const vec3_t<T>& c0, const vec3_t<T>& c1, const vec3_t<T>& c2, const vec3_t<T>& c3, const T* t, size_t n, vec3Array_t<T> pos, vec3Array_t<T> vel, vec3Array_t<T> acc)
+{
+    cubicBatch<T> b;
+    const vec3_t<T>* c[4] = { &c0, &c1, &c2, &c3 };
+    for (int p = 0; p < 4; p++) {
+        b.c[p][0] = c[p]->x;
+        b.c[p][1] = c[p]->y;
+        b.c[p][2] = c[p]->z;
+    }
+    b.t = t;
+    b.n = n;
+    vec3Array_t<T>* out[3] = { &pos, &vel, &acc };
+    for (int d = 0; d < 3; d++) {
+        b.out[d][0] = out[d]->x;
+        b.out[d][1] = out[d]->y;
+        b.out[d][2] = out[d]->z;
+    }
+
+    switch ( currentInstructionSet ) {
+#ifdef SCV_BATCH_X86
+    case BIS_AVX2:
+        evaluate_avx2(b);
+        break;
+    case BIS_SSE:
+        evaluate_sse(b);
+        break;
+#endif
+    default:
+        evaluate_scalar(b);
+    }
+}
+
+template void evaluateCubicBatch(const vec3_t<float>& c0, const vec3_t<float>& c1, const vec3_t<float>& c2, const vec3_t<float>& c3, const float* t, size_t n, vec3Array_t<float> pos, vec3Array_t<float> vel, vec3Array_t<float> acc);
+template void evaluateCubicBatch(const vec3_t<double>& c0, const vec3_t<double>& c1, const vec3_t<double>& c2, const vec3_t<double>& c3, const double* t, size_t n, vec3Array_t<double> pos, vec3Array_t<double> vel, vec3Array_t<double> acc);
+
+template <typename T>
+static void solveProfiles(const profileBatch<T>& b)
+{
+    switch ( currentInstructionSet ) {
+#ifdef SCV_BATCH_X86
+    case BIS_AVX2:
+        solveProfiles_avx2(b);
+        break;
+    case BIS_SSE:
+        solveProfiles_sse(b);
+        break;
+#endif
+    default:
+        solveProfiles_scalar(b);
+    }
+}
+
+template <typename T>
+void solveProfileBatch(const T* length, const T* vel, const T* acc, const T* jerk, size_t n, T* T1, T* TL, T* T2)
+{
+    // 32 bytes is the widest register
+    const size_t maxWidth = 32 / sizeof(T);
+    size_t width = 1;
+    if ( currentInstructionSet == BIS_AVX2 )
+        width = 32 / sizeof(T);
+    else if ( currentInstructionSet == BIS_SSE )
+        width = 16 / sizeof(T);
+
+    profileBatch<T> b = { length, vel, acc, jerk, n - n % width, T1, TL, T2 };
+    if ( b.n > 0 )
+        solveProfiles(b);
+
+    // The last few moves are copied into a whole register's worth (padded out by repeating the first
+    // of them), so that they go through exactly the same instructions as the others
+    size_t rest = n - b.n;
+    if ( rest > 0 ) {
+        T in[4][maxWidth];
+        T out[3][maxWidth];
+        for (size_t k = 0; k < width; k++) {
+            size_t src = b.n + (k < rest ? k : 0);
+            in[0][k] = length[src];
+            in[1][k] = vel[src];
+            in[2][k] = acc[src];
+            in[3][k] = jerk[src];
+        }
+        profileBatch<T> tail = { in[0], in[1], in[2], in[3], width, out[0], out[1], out[2] };
+        solveProfiles(tail);
+        for (size_t k = 0; k < rest; k++) {
+            T1[b.n + k] = out[0][k];
+            TL[b.n + k] = out[1][k];
+            T2[b.n + k] = out[2][k];
+        }
+    }
+}
+
+template void solveProfileBatch(const float* length, const float* vel, const float* acc, const float* jerk, size_t n, float* T1, float* TL, float* T2);
+template void solveProfileBatch(const double* length, const double* vel, const double* acc, const double* jerk, size_t n, double* T1, double* TL, double* T2);
+
+} // namespace
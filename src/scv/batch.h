@@ -0,0 +1,38 @@
+#ifndef SCV_BATCH_H
+#define SCV_BATCH_H
+
+#include "vec3.h"
+
+namespace scv {
+
+    enum batchInstructionSet {
+        BIS_SCALAR,
+        BIS_SSE,
+        BIS_AVX2
+    };
+
+    // Evaluates the cubic p(t) = c0 + c1*t + c2*t^2 + c3*t^3 (for each axis) and its first two
+    // derivatives at n time offsets. Results are written to entries [0,n) of pos/vel/acc, any of
+    // which can be null. Several time offsets are evaluated per instruction, using AVX2 or SSE if
+    // the CPU supports them. Built for float and double, with twice as many time offsets per
+    // instruction for float.
+    template <typename T>
+    void evaluateCubicBatch(const vec3_t<T>& c0, const vec3_t<T>& c1, const vec3_t<T>& c2, const vec3_t<T>& c3, const T* t, size_t n, vec3Array_t<T> pos, vec3Array_t<T> vel, vec3Array_t<T> acc);
+
+    // Finds the segment durations of n moves that start and end at rest: T1 for the first and last
+    // curves, T2 for the curves either side of the constant speed part, and TL for the constant
+    // acceleration between them (zero if full acceleration is not reached). Each move is given by its length and its speed,
+    // acceleration and jerk limits. Several moves are solved per instruction like evaluateCubicBatch,
+    // and a move gets the same result whether it is solved by itself or as part of a batch.
+    template <typename T>
+    void solveProfileBatch(const T* length, const T* vel, const T* acc, const T* jerk, size_t n, T* T1, T* TL, T* T2);
+
+    // The instruction set used by evaluateCubicBatch and solveProfileBatch. This is chosen at runtime to be the best
+    // available on the CPU, but can be lowered for comparison. Requests for an instruction set
+    // the CPU does not support will use the best available instead.
+    batchInstructionSet getBatchInstructionSet();
+    void setBatchInstructionSet(batchInstructionSet bis);
+
+} // namespace
+
+#endif
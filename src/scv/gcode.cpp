@@ -0,0 +1,718 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include "gcode.h"
+#include "parallel.h"
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// Floating point from_chars is only there in newer standard libraries, older ones get strtod instead
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    #define SCV_GCODE_FROM_CHARS
+#endif
+
+namespace scv {
+
+// A file mapped into memory for reading
+class mappedFile {
+public:
+    const char* data;
+    size_t size;
+
+    mappedFile() {
+        data = 0;
+        size = 0;
+#ifdef _WIN32
+        file = INVALID_HANDLE_VALUE;
+        mapping = 0;
+#endif
+    }
+
+    ~mappedFile() {
+        close();
+    }
+
+    bool open(const char* filename) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+        if ( file == INVALID_HANDLE_VALUE )
+            return false;
+        LARGE_INTEGER fileSize;
+        if ( ! GetFileSizeEx(file, &fileSize) ) {
+            close();
+            return false;
+        }
+        size = (size_t)fileSize.QuadPart;
+        if ( size == 0 )
+            return true; // can't map an empty file, but there's nothing to read anyway
+        mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+        if ( mapping )
+            data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if ( ! data ) {
+            close();
+            return false;
+        }
+#else
+        int fd = ::open(filename, O_RDONLY);
+        if ( fd < 0 )
+            return false;
+        struct stat st;
+        if ( fstat(fd, &st) != 0 ) {
+            ::close(fd);
+            return false;
+        }
+        size = (size_t)st.st_size;
+        if ( size > 0 ) {
+            void* p = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if ( p == MAP_FAILED ) {
+                ::close(fd);
+                size = 0;
+                return false;
+            }
+            madvise(p, size, MADV_SEQUENTIAL);
+            data = (const char*)p;
+        }
+        ::close(fd); // the mapping stays valid without it
+#endif
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if ( data )
+            UnmapViewOfFile(data);
+        if ( mapping )
+            CloseHandle(mapping);
+        if ( file != INVALID_HANDLE_VALUE )
+            CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+        mapping = 0;
+#else
+        if ( data )
+            munmap((void*)data, size);
+#endif
+        data = 0;
+        size = 0;
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+
+    mappedFile(const mappedFile&);
+    mappedFile& operator=(const mappedFile&);
+};
+
+// Reads the number at p, returning the end of it, or null if there isn't one. Only plain numbers are
+// taken, not 'inf' or 'nan', which the chunked parser below uses to mark values it doesn't know yet.
+template <typename F>
+static const char* parseNumber(const char* p, const char* end, F* value)
+{
+    if ( p < end && *p == '+' )
+        p++;
+    const char* digits = (p < end && *p == '-') ? p + 1 : p;
+    if ( digits >= end || ! ((*digits >= '0' && *digits <= '9') || *digits == '.') )
+        return 0;
+#ifdef SCV_GCODE_FROM_CHARS
+    std::from_chars_result r = std::from_chars(p, end, *value);
+    return r.ec == std::errc() ? r.ptr : 0;
+#else
+    // strtod needs a null terminated string, and the text might end right after the number
+    char buf[64];
+    size_t n = 0;
+    while ( p + n < end && n < sizeof(buf) - 1 && strchr("0123456789.-+eE", p[n]) && p[n] )
+        n++;
+    memcpy(buf, p, n);
+    buf[n] = 0;
+    char* numEnd;
+    double d = strtod(buf, &numEnd);
+    if ( numEnd == buf )
+        return 0;
+    *value = (F)d;
+    return p + (numEnd - buf);
+#endif
+}
+
+static inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Longest arc move made from a G2/G3, as the planner follows arcs of up to 45 degrees closely
+static const double maxArcMoveAngle = 0.7853981633974483;
+
+// How much further from the center the end of a G2/G3 can be than its start, the same as Grbl allows.
+// Anything within the first is fine, and otherwise it must be within both of the others.
+static const double arcRadiusTolerance = 0.005;
+static const double arcRadiusToleranceMax = 0.5;
+static const double arcRadiusToleranceRelative = 0.001;    // of the radius
+
+// Chunked parsing (see parseGCode) starts each chunk without knowing the state left by the chunks
+// before it. The feed rate is always given as it is, so it starts out NaN and is filled in afterwards.
+// The position and E can be relative though, so they start out at zero and each is tagged with what it
+// is relative to: nothing, or the value (or G92 origin) at the start of the chunk. Every command only
+// ever adds a number to one of these or copies one, so a single tag is always enough.
+enum { TAG_KNOWN = 0, TAG_START = 1, TAG_ORIGIN = 2 };
+
+struct chunkTags {
+    unsigned char pos[4];               // X, Y, Z and E
+    unsigned char origin[4];
+    bool setsRelative;                  // has a G90 or G91, so the mode at its end doesn't depend on its start
+    bool setsRelativeExtrusion;         // has an M82 or M83
+    std::vector<unsigned char> moves;   // the tags of the dst and scaler of each move, two bits each
+
+    void reset() {
+        for (int a = 0; a < 4; a++) {
+            pos[a] = TAG_START;
+            origin[a] = TAG_ORIGIN;
+        }
+        setsRelative = false;
+        setsRelativeExtrusion = false;
+        moves.clear();
+    }
+
+    static unsigned char pack(const unsigned char* t) {
+        return (unsigned char)(t[0] | (t[1] << 2) | (t[2] << 4) | (t[3] << 6));
+    }
+};
+
+// A G2/G3 line, which is first added to the moves as if it were a straight move and then replaced by
+// arc moves (see expandArcs). Where the center is can't be worked out until the start of the move is
+// known, which for chunked parsing isn't until the chunks before it are done.
+template <typename F>
+struct gcodeArc {
+    size_t move;            // index of the move it was added as
+    bool clockwise;         // G2
+    bool hasCenter;         // I and J give the center, otherwise R gives the radius
+    F centerX, centerY;     // from the start of the move
+    F radius;               // negative for the long way around
+    F startExtrusion;       // E at the start of the move
+    unsigned char startExtrusionTag;
+};
+
+// Parses one line (without its newline), appending a move if it is a G0/G1 that changes the position,
+// a G2/G3 arc (whose details go in 'arcs') or a G4 dwell. 'tags' is only given for chunked parsing.
+template <typename F>
+static void parseLine(const char* p, const char* end, const move_t<F>& base, gcodeState_t<F>& state, std::vector<move_t<F> >& moves, std::vector<gcodeArc<F> >& arcs, chunkTags* tags)
+{
+    int motion = -1;            // the number of a G0, G1, G2 or G3
+    bool isDwell = false;       // G4
+    bool isSetPosition = false; // G92
+    F words[4];                 // X, Y, Z and E
+    bool hasWord[4] = { false, false, false, false };
+    F feedRate = state.feedRate;
+    F dwell = 0;
+    gcodeArc<F> arc;
+    arc.hasCenter = false;
+    arc.centerX = 0;
+    arc.centerY = 0;
+    arc.radius = 0;
+
+    while ( p < end ) {
+        char c = *p;
+        if ( isBlank(c) ) {
+            p++;
+            continue;
+        }
+        if ( c == ';' )
+            break;
+        if ( c == '(' ) {
+            const char* close = (const char*)memchr(p, ')', end - p);
+            if ( ! close )
+                break;
+            p = close + 1;
+            continue;
+        }
+
+        char letter = (char)(c & ~0x20); // upper case
+        F value;
+        const char* numEnd = parseNumber(p + 1, end, &value);
+        if ( ! numEnd ) {
+            // not a word, eg. the text of an M117 message
+            while ( p < end && ! isBlank(*p) )
+                p++;
+            continue;
+        }
+        p = numEnd;
+
+        switch ( letter ) {
+        case 'G':
+            if ( value == 0 || value == 1 || value == 2 || value == 3 )
+                motion = (int)value;
+            else if ( value == 4 )
+                isDwell = true;
+            else if ( value == 92 )
+                isSetPosition = true;
+            else if ( value == 90 || value == 91 ) {
+                state.relative = value == 91;
+                if ( tags )
+                    tags->setsRelative = true;
+            }
+            break;
+        case 'M':
+            if ( value == 82 || value == 83 ) {
+                state.relativeExtrusion = value == 83;
+                if ( tags )
+                    tags->setsRelativeExtrusion = true;
+            }
+            break;
+        case 'X': words[0] = value; hasWord[0] = true; break;
+        case 'Y': words[1] = value; hasWord[1] = true; break;
+        case 'Z': words[2] = value; hasWord[2] = true; break;
+        case 'E': words[3] = value; hasWord[3] = true; break;
+        case 'F':
+            // per minute to per second. Firmware ignores a feed rate that isn't positive rather than
+            // stopping every move after it, so that keeps the last one too.
+            if ( value > 0 )
+                feedRate = value / 60;
+            break;
+        case 'P': dwell = value / 1000; break;  // milliseconds
+        case 'S': dwell = value; break;
+        case 'I': arc.centerX = value; arc.hasCenter = true; break;
+        case 'J': arc.centerY = value; arc.hasCenter = true; break;
+        case 'R': arc.radius = value; break;
+        default:
+            break;
+        }
+    }
+
+    F current[4] = { state.pos.x, state.pos.y, state.pos.z, state.extrusion };
+    F origin[4] = { state.origin.x, state.origin.y, state.origin.z, state.extrusionOrigin };
+
+    if ( isSetPosition ) {
+        // the origin moves so that the current position reads as the given values
+        bool all = ! (hasWord[0] || hasWord[1] || hasWord[2] || hasWord[3]);
+        for (int a = 0; a < 4; a++) {
+            if ( ! all && ! hasWord[a] )
+                continue;
+            origin[a] = current[a] - (all ? 0 : words[a]);
+            if ( tags )
+                tags->origin[a] = tags->pos[a];
+        }
+        state.origin = vec3_t<F>(origin[0], origin[1], origin[2]);
+        state.extrusionOrigin = origin[3];
+        return;
+    }
+
+    if ( isDwell ) {
+        if ( dwell > 0 ) {
+            moves.push_back(base);
+            move_t<F>& m = moves.back();
+            m.src = state.pos;
+            m.dst = state.pos;
+            m.arcAngle = 0;
+            m.dwell = dwell;
+            m.vel = state.feedRate;
+            m.scaler = state.extrusion;
+            if ( tags )
+                tags->moves.push_back(chunkTags::pack(tags->pos));
+        }
+        return;
+    }
+
+    bool isArc = motion >= 2;
+    if ( motion < 0 || (isArc && ! arc.hasCenter && arc.radius == 0) )
+        return;
+
+    arc.startExtrusion = state.extrusion;
+    arc.startExtrusionTag = tags ? tags->pos[3] : (unsigned char)TAG_KNOWN;
+    unsigned char tagsBefore = tags ? chunkTags::pack(tags->pos) : 0;
+    for (int a = 0; a < 4; a++) {
+        if ( ! hasWord[a] )
+            continue;
+        if ( a < 3 ? state.relative : state.relativeExtrusion )
+            current[a] += words[a];
+        else {
+            current[a] = words[a] + origin[a];
+            if ( tags )
+                tags->pos[a] = tags->origin[a];
+        }
+    }
+
+    vec3_t<F> pos(current[0], current[1], current[2]);
+    bool moved = ! (pos == state.pos) || (tags && ((chunkTags::pack(tags->pos) ^ tagsBefore) & 0x3f));
+    state.extrusion = current[3];
+    state.feedRate = feedRate;
+    if ( ! isArc && ! moved ) // an arc back to where it started is a full circle
+        return;
+
+    moves.push_back(base);
+    move_t<F>& m = moves.back();
+    m.src = state.pos;
+    m.dst = pos;
+    m.arcAngle = 0;
+    m.dwell = 0;
+    m.vel = feedRate;
+    m.scaler = current[3];
+    state.pos = pos;
+    if ( tags )
+        tags->moves.push_back(chunkTags::pack(tags->pos));
+
+    if ( isArc ) {
+        arc.move = moves.size() - 1;
+        arc.clockwise = motion == 2;
+        arcs.push_back(arc);
+    }
+}
+
+// Adds the arc moves for a G2/G3, at most maxArcMoveAngle each. 'm' is the move the line was added as.
+template <typename F>
+static void appendArcMoves(const move_t<F>& m, const gcodeArc<F>& arc, std::vector<move_t<F> >& out)
+{
+    const double pi = 3.141592653589793;
+
+    double x0 = m.src.x, y0 = m.src.y;
+    double x1 = m.dst.x, y1 = m.dst.y;
+    double cx, cy;
+    if ( arc.hasCenter ) {
+        cx = x0 + arc.centerX;
+        cy = y0 + arc.centerY;
+    }
+    else {
+        // The center is on the perpendicular bisector of the chord, on the side that makes the shorter
+        // arc turn the right way, or on the other side for a negative radius
+        double dx = x1 - x0, dy = y1 - y0;
+        double d = sqrt(dx * dx + dy * dy);
+        if ( d == 0 )
+            return;
+        double h = sqrt(std::max(arc.radius * arc.radius - 0.25 * d * d, 0.0));
+        double side = arc.clockwise != (arc.radius < 0) ? -1 : 1;
+        cx = 0.5 * (x0 + x1) - side * h / d * dy;
+        cy = 0.5 * (y0 + y1) + side * h / d * dx;
+    }
+
+    double r0 = sqrt((x0 - cx) * (x0 - cx) + (y0 - cy) * (y0 - cy));
+    double r1 = sqrt((x1 - cx) * (x1 - cx) + (y1 - cy) * (y1 - cy));
+    double dr = fabs(r1 - r0);
+    bool offCircle = dr > arcRadiusTolerance && (dr > arcRadiusToleranceMax || dr > arcRadiusToleranceRelative * r0);
+    if ( offCircle )
+        printf("Arc ends %g further from its center than it starts, going straight instead\n", r1 - r0);
+    if ( r0 == 0 || r1 == 0 || offCircle ) {
+        // nothing to go around (or firmware would refuse the arc), so just go straight there
+        vec3_t<F> src = m.src;
+        if ( ! (src == m.dst) )
+            out.push_back(m);
+        return;
+    }
+
+    double a0 = atan2(y0 - cy, x0 - cx);
+    double sweep = atan2(y1 - cy, x1 - cx) - a0;
+    if ( arc.clockwise ) {
+        if ( sweep >= 0 )
+            sweep -= 2 * pi;
+    }
+    else if ( sweep <= 0 )
+        sweep += 2 * pi;
+
+    int n = std::max((int)ceil(fabs(sweep) / maxArcMoveAngle - 0.000001), 1);
+    move_t<F> piece = m;
+    piece.arcCenter = vec3_t<F>((F)cx, (F)cy, 0);
+    piece.arcAngle = (F)(sweep / n);
+    for (int k = 1; k <= n; k++) {
+        double u = (double)k / n;
+        double angle = a0 + sweep * u;
+        double radius = r0 + (r1 - r0) * u;
+        piece.dst = k == n ? m.dst : vec3_t<F>((F)(cx + radius * cos(angle)), (F)(cy + radius * sin(angle)), (F)(m.src.z + (m.dst.z - m.src.z) * u));
+        piece.scaler = k == n ? m.scaler : (F)(arc.startExtrusion + (m.scaler - arc.startExtrusion) * u);
+        out.push_back(piece);
+        piece.src = piece.dst;
+    }
+}
+
+// Replaces the moves that G2/G3 lines were added as, from 'first' on, with their arc moves
+template <typename F>
+static void expandArcs(std::vector<move_t<F> >& moves, size_t first, const std::vector<gcodeArc<F> >& arcs)
+{
+    if ( arcs.empty() )
+        return;
+
+    std::vector<move_t<F> > expanded;
+    expanded.reserve(moves.size() - first + 4 * arcs.size());
+    size_t next = 0;
+    for (size_t i = first; i < moves.size(); i++) {
+        if ( next < arcs.size() && arcs[next].move == i )
+            appendArcMoves(moves[i], arcs[next++], expanded);
+        else
+            expanded.push_back(moves[i]);
+    }
+    moves.erase(moves.begin() + first, moves.end());
+    moves.insert(moves.end(), expanded.begin(), expanded.end());
+}
+
+// Appends the moves of whole lines in [p, end), reserving room for them first. Arcs are left as they
+// were added, for expandArcs.
+template <typename F>
+static void parseLines(const char* p, const char* end, const move_t<F>& base, gcodeState_t<F>& state, std::vector<move_t<F> >& moves, std::vector<gcodeArc<F> >& arcs, chunkTags* tags)
+{
+    // Most lines of a sliced file are moves, so the lines starting with G are a close upper bound on the
+    // number of moves. Counting them is much quicker than growing the vector as we go.
+    size_t numG = (p < end && (*p == 'G' || *p == 'g')) ? 1 : 0;
+    for (const char* q = p; (q = (const char*)memchr(q, '\n', end - q)) != 0 && ++q < end; )
+        if ( *q == 'G' || *q == 'g' )
+            numG++;
+    moves.reserve(moves.size() + numG);
+    if ( tags )
+        tags->moves.reserve(tags->moves.size() + numG);
+
+    while ( p < end ) {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if ( ! eol )
+            eol = end;
+        parseLine(p, eol, base, state, moves, arcs, tags);
+        p = eol + 1;
+    }
+}
+
+// Smallest part of a file worth giving its own thread
+#define MINCHUNKBYTES (1 << 20)
+
+// A feed rate the chunk didn't know yet is NaN
+template <typename F>
+static inline F resolve(F value, F known)
+{
+    return std::isnan(value) ? known : value;
+}
+
+// A position or E that is relative to what it was at the start of the chunk (see chunkTags)
+template <typename F>
+static inline F resolve(F value, int tag, F start, F origin)
+{
+    if ( tag == TAG_START )
+        return value + start;
+    if ( tag == TAG_ORIGIN )
+        return value + origin;
+    return value;
+}
+
+template <typename F>
+static inline vec3_t<F> resolve(const vec3_t<F>& v, unsigned char tags, const gcodeState_t<F>& start)
+{
+    return vec3_t<F>(resolve(v.x, tags & 3, start.pos.x, start.origin.x),
+                     resolve(v.y, (tags >> 2) & 3, start.pos.y, start.origin.y),
+                     resolve(v.z, (tags >> 4) & 3, start.pos.z, start.origin.z));
+}
+
+// The state at the end of a chunk, given the state at its start
+template <typename F>
+static gcodeState_t<F> resolve(const gcodeState_t<F>& end, const chunkTags& tags, const gcodeState_t<F>& start)
+{
+    unsigned char posTags = chunkTags::pack(tags.pos);
+    unsigned char originTags = chunkTags::pack(tags.origin);
+    gcodeState_t<F> s;
+    s.pos = resolve(end.pos, posTags, start);
+    s.extrusion = resolve(end.extrusion, posTags >> 6, start.extrusion, start.extrusionOrigin);
+    s.origin = resolve(end.origin, originTags, start);
+    s.extrusionOrigin = resolve(end.extrusionOrigin, originTags >> 6, start.extrusion, start.extrusionOrigin);
+    s.feedRate = resolve(end.feedRate, start.feedRate);
+    s.relative = tags.setsRelative ? end.relative : start.relative;
+    s.relativeExtrusion = tags.setsRelativeExtrusion ? end.relativeExtrusion : start.relativeExtrusion;
+    return s;
+}
+
+// Fills in the moves of a chunk from the state at its start, then expands its arcs. Each move starts
+// where the one before it ended. A line that looked like it might move can turn out to stay where it
+// was (eg. X10 when X was already 10), and those moves are dropped, the same as when parsing in one go.
+template <typename F>
+static void resolveMoves(std::vector<move_t<F> >& moves, std::vector<gcodeArc<F> >& arcs, const chunkTags& tags, const gcodeState_t<F>& start)
+{
+    size_t n = 0;
+    size_t nextArc = 0;
+    vec3_t<F> last = start.pos;
+    for (size_t i = 0; i < moves.size(); i++) {
+        move_t<F>& m = moves[i];
+        unsigned char t = tags.moves[i];
+        m.src = last;
+        m.dst = resolve(m.dst, t, start);
+        if ( nextArc < arcs.size() && arcs[nextArc].move == i ) {
+            gcodeArc<F>& arc = arcs[nextArc++];
+            arc.move = n;
+            arc.startExtrusion = resolve(arc.startExtrusion, arc.startExtrusionTag, start.extrusion, start.extrusionOrigin);
+        }
+        else if ( m.src == m.dst && m.dwell <= 0 )
+            continue;
+        m.vel = resolve(m.vel, start.feedRate);
+        m.scaler = resolve(m.scaler, t >> 6, start.extrusion, start.extrusionOrigin);
+        last = m.dst;
+        if ( n != i )
+            moves[n] = m;
+        n++;
+    }
+    moves.erase(moves.begin() + n, moves.end());
+    expandArcs(moves, 0, arcs);
+}
+
+template <typename F>
+size_t parseGCode(const char* text, size_t length, const move_t<F>& base, gcodeState_t<F>& state, std::vector<move_t<F> >& moves, int numThreads)
+{
+    const char* end = text + length;
+    size_t numBefore = moves.size();
+
+    // The modes set by G90/G91 and M82/M83 change how the numbers are read, so unlike the position they
+    // can't be filled in afterwards. Files nearly always set them once near the start, so the first
+    // MINCHUNKBYTES are parsed by themselves, and each chunk after that starts out with the modes left
+    // there. A chunk that turns out to have started with the wrong modes is parsed again.
+    const char* chunked = text;
+    size_t numChunks = (size_t)resolveNumThreads(numThreads);
+    if ( numChunks > length / MINCHUNKBYTES )
+        numChunks = length / MINCHUNKBYTES;
+    if ( numChunks > 1 ) {
+        const char* eol = (const char*)memchr(text + MINCHUNKBYTES, '\n', length - MINCHUNKBYTES);
+        chunked = eol ? eol + 1 : end;
+        std::vector<gcodeArc<F> > arcs;
+        parseLines(text, chunked, base, state, moves, arcs, (chunkTags*)0);
+        expandArcs(moves, numBefore, arcs);
+        numChunks = std::min(numChunks, (size_t)(end - chunked) / MINCHUNKBYTES);
+    }
+    if ( numChunks <= 1 ) {
+        size_t first = moves.size();
+        std::vector<gcodeArc<F> > arcs;
+        parseLines(chunked, end, base, state, moves, arcs, (chunkTags*)0);
+        expandArcs(moves, first, arcs);
+        return moves.size() - numBefore;
+    }
+
+    // split the rest into roughly equal chunks of whole lines
+    size_t restLength = end - chunked;
+    std::vector<const char*> starts(numChunks + 1);
+    starts[0] = chunked;
+    starts[numChunks] = end;
+    for (size_t c = 1; c < numChunks; c++) {
+        const char* p = std::max(chunked + restLength / numChunks * c, starts[c - 1]);
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        starts[c] = eol ? eol + 1 : end;
+    }
+
+    std::vector<std::vector<move_t<F> > > chunkMoves(numChunks);
+    std::vector<std::vector<gcodeArc<F> > > chunkArcs(numChunks);
+    std::vector<chunkTags> tags(numChunks);
+    std::vector<gcodeState_t<F> > chunkStates(numChunks + 1);
+    std::vector<gcodeState_t<F> > modes(numChunks, state); // the modes each chunk was parsed with
+    auto parseChunk = [&](size_t c) {
+        gcodeState_t<F>& s = chunkStates[c + 1];
+        s = gcodeState_t<F>();
+        s.feedRate = std::numeric_limits<F>::quiet_NaN();
+        s.relative = modes[c].relative;
+        s.relativeExtrusion = modes[c].relativeExtrusion;
+        tags[c].reset();
+        chunkMoves[c].clear();
+        chunkArcs[c].clear();
+        parseLines(starts[c], starts[c + 1], base, s, chunkMoves[c], chunkArcs[c], &tags[c]);
+    };
+    parallelFor(0, numChunks, (int)numChunks, 1, parseChunk);
+
+    // only the modes in 'known' are right until the chunks are parsed with the right modes
+    std::vector<size_t> wrongModes;
+    gcodeState_t<F> known = state;
+    for (size_t c = 0; c < numChunks; c++) {
+        if ( modes[c].relative != known.relative || modes[c].relativeExtrusion != known.relativeExtrusion ) {
+            modes[c] = known;
+            wrongModes.push_back(c);
+        }
+        known = resolve(chunkStates[c + 1], tags[c], known);
+    }
+    if ( ! wrongModes.empty() )
+        parallelFor(0, wrongModes.size(), (int)numChunks, 1, [&](size_t k) { parseChunk(wrongModes[k]); });
+
+    // chunkStates[c] becomes the state at the start of chunk c
+    chunkStates[0] = state;
+    for (size_t c = 0; c < numChunks; c++)
+        chunkStates[c + 1] = resolve(chunkStates[c + 1], tags[c], chunkStates[c]);
+    state = chunkStates[numChunks];
+
+    parallelFor(0, numChunks, (int)numChunks, 1, [&](size_t c) {
+        resolveMoves(chunkMoves[c], chunkArcs[c], tags[c], chunkStates[c]);
+        std::vector<unsigned char>().swap(tags[c].moves);
+    });
+
+    std::vector<size_t> offsets(numChunks + 1);
+    offsets[0] = moves.size();
+    for (size_t c = 0; c < numChunks; c++)
+        offsets[c + 1] = offsets[c] + chunkMoves[c].size();
+    moves.resize(offsets[numChunks], base);
+
+    parallelFor(0, numChunks, (int)numChunks, 1, [&](size_t c) {
+        std::copy(chunkMoves[c].begin(), chunkMoves[c].end(), moves.begin() + offsets[c]);
+        std::vector<move_t<F> >().swap(chunkMoves[c]);
+    });
+
+    return moves.size() - numBefore;
+}
+
+template <typename F>
+bool loadGCodeFile(const char* filename, const move_t<F>& base, std::vector<move_t<F> >& moves, int numThreads)
+{
+    mappedFile file;
+    if ( ! file.open(filename) )
+        return false;
+
+    gcodeState_t<F> state;
+    state.pos = base.dst;
+    state.feedRate = base.vel;
+    state.extrusion = base.scaler;
+    parseGCode(file.data, file.size, base, state, moves, numThreads);
+    return true;
+}
+
+template <typename F>
+bool loadGCodeFile(const char* filename, const move_t<F>& base, size_t batchSize, gcodeBatchCallback_t<F> callback, void* userData)
+{
+    mappedFile file;
+    if ( ! file.open(filename) )
+        return false;
+    if ( batchSize == 0 )
+        batchSize = 1;
+
+    gcodeState_t<F> state;
+    state.pos = base.dst;
+    state.feedRate = base.vel;
+    state.extrusion = base.scaler;
+
+    std::vector<move_t<F> > moves;
+    std::vector<gcodeArc<F> > arcs;
+    const char* p = file.data;
+    const char* end = file.data + file.size;
+    while ( p < end ) {
+        if ( moves.capacity() < batchSize )
+            moves.reserve(batchSize);
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if ( ! eol )
+            eol = end;
+        parseLine(p, eol, base, state, moves, arcs, (chunkTags*)0);
+        p = eol + 1;
+        if ( moves.size() >= batchSize ) {
+            expandArcs(moves, 0, arcs);
+            arcs.clear();
+            callback(moves, userData);
+            moves.clear();
+        }
+    }
+    expandArcs(moves, 0, arcs);
+    if ( ! moves.empty() )
+        callback(moves, userData);
+    return true;
+}
+
+template size_t parseGCode(const char* text, size_t length, const move_t<float>& base, gcodeState_t<float>& state, std::vector<move_t<float> >& moves, int numThreads);
+template size_t parseGCode(const char* text, size_t length, const move_t<double>& base, gcodeState_t<double>& state, std::vector<move_t<double> >& moves, int numThreads);
+template bool loadGCodeFile(const char* filename, const move_t<float>& base, std::vector<move_t<float> >& moves, int numThreads);
+template bool loadGCodeFile(const char* filename, const move_t<double>& base, std::vector<move_t<double> >& moves, int numThreads);
+template bool loadGCodeFile(const char* filename, const move_t<float>& base, size_t batchSize, gcodeBatchCallback_t<float> callback, void* userData);
+template bool loadGCodeFile(const char* filename, const move_t<double>& base, size_t batchSize, gcodeBatchCallback_t<double> callback, void* userData);
+
+} // namespace
@@ -0,0 +1,86 @@
+#ifndef SCV_GCODE_H
+#define SCV_GCODE_H
+
+#include <vector>
+#include "planner.h"
+
+namespace scv {
+
+    // Reading moves from G-code. Like the planner these are templates on the floating point type F, built
+    // for float and double in gcode.cpp. Only G0 and G1 lines make moves, using their X, Y, Z, E and F
+    // words, along with G2 (clockwise) and G3 (anticlockwise) arcs in the XY plane. An arc's center is
+    // given by I and J relative to its start, or by R (negative for the long way around), and an arc that
+    // ends where it started is a full circle. An arc whose end is further from the center than its start
+    // by more than firmware allows (0.005, or up to 0.5 and 0.1% of the radius, as in Grbl) goes straight
+    // to its end instead. Each arc becomes arc moves of at most 45 degrees (see move_t::arcAngle), with
+    // Z and E changing evenly along it. The position and the last E and F carry on from one line to the
+    // next, with E becoming the scaler of the moves and F their speed limit. F is in units per minute, as
+    // in G-code, and is divided by 60 to give the planner's units per second. An F of zero or less is
+    // ignored and the last feed rate kept, as firmware does.
+    //
+    // The modal commands are followed too, so files don't need converting first:
+    //   G90/G91    X, Y and Z are absolute or relative to the last position (E is not affected)
+    //   M82/M83    E is absolute or relative to the last E
+    //   G92        makes the current position read as the given X, Y, Z and E (all zero if none are
+    //              given), without moving. The moves are still in the same coordinates as before, so the
+    //              path doesn't jump, and the scaler keeps counting on from where it was (eg. after the
+    //              G92 E0 that slicers put at each layer).
+    //   G4         waits for P milliseconds or S seconds, as a move that stays put (see move_t::dwell)
+    // Comments (after ';' or in brackets) are skipped, as are lines with any other command.
+
+    // What carries on from one line of G-code to the next
+    template <typename F>
+    struct gcodeState_t {
+        vec3_t<F> pos;          // where the last move ended
+        F feedRate;             // the last F word, in units per second
+        F extrusion;            // E at the end of the last move
+        vec3_t<F> origin;       // where X0 Y0 Z0 is, as moved by G92
+        F extrusionOrigin;      // where E0 is, as moved by G92
+        bool relative;          // G91
+        bool relativeExtrusion; // M83
+
+        gcodeState_t() {
+            pos = vec3_t<F>(0, 0, 0);
+            feedRate = 0;
+            extrusion = 0;
+            origin = vec3_t<F>(0, 0, 0);
+            extrusionOrigin = 0;
+            relative = false;
+            relativeExtrusion = false;
+        }
+    };
+
+    typedef gcodeState_t<scv_float> gcodeState;
+
+    // Appends the moves for each G0/G1 line in [text, text+length) that changes the position, each
+    // G2/G3 arc and each G4 dwell. The limits and blend settings of each move are copied from 'base'.
+    // The text does not need to be null terminated, and a last line without a newline is still read.
+    // Returns the number of moves appended. Long texts are split into chunks of whole lines parsed on up
+    // to numThreads threads (zero for one per core), which gives the same moves and end state as parsing
+    // in one go, except that relative coordinates are added up in a different order, so they can differ
+    // by rounding.
+    template <typename F>
+    size_t parseGCode(const char* text, size_t length, const move_t<F>& base, gcodeState_t<F>& state, std::vector<move_t<F> >& moves, int numThreads = 1);
+
+    // Reads a whole G-code file, starting from the position in base.dst with base.vel as the speed limit
+    // until an F word changes it. The file is mapped into memory rather than read line by line, and
+    // parsed on up to numThreads threads as in parseGCode. Returns false if the file can't be opened.
+    template <typename F>
+    bool loadGCodeFile(const char* filename, const move_t<F>& base, std::vector<move_t<F> >& moves, int numThreads = 1);
+
+    // Called by loadGCodeFile with each batch of moves. The callback can take the contents of 'moves'
+    // (eg. by swapping or moving it into a queue), otherwise they are cleared after it returns.
+    template <typename F>
+    using gcodeBatchCallback_t = void (*)(std::vector<move_t<F> >& moves, void* userData);
+
+    typedef gcodeBatchCallback_t<scv_float> gcodeBatchCallback;
+
+    // Same as above, but gives the moves to 'callback' in batches of about 'batchSize' (a few more if the
+    // last line was an arc, and the last batch can be smaller) rather than holding all of them, eg. to
+    // start planning before the whole file is read.
+    template <typename F>
+    bool loadGCodeFile(const char* filename, const move_t<F>& base, size_t batchSize, gcodeBatchCallback_t<F> callback, void* userData = 0);
+
+} // namespace
+
+#endif
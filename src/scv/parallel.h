@@ -0,0 +1,120 @@
+#ifndef SCV_PARALLEL_H
+#define SCV_PARALLEL_H
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace scv {
+
+    // The number of threads to use when asked for 'requested' threads, where zero means one per core
+    inline int resolveNumThreads(int requested)
+    {
+        if ( requested > 0 )
+            return requested;
+        int n = (int)std::thread::hardware_concurrency();
+        return n > 0 ? n : 1;
+    }
+
+    // Calls func(i) for every i in [begin,end), spread over up to numThreads threads (including the
+    // calling thread). The range is handed out in chunks of at least 'grain' indices from a shared
+    // counter, so threads that finish early take more chunks instead of waiting for the slow ones.
+    // The calls for different i can happen in any order, so func must only write to things that
+    // belong to index i. Ranges too small to be worth starting threads for are just looped over.
+    template <typename F>
+    void parallelFor(size_t begin, size_t end, int numThreads, size_t grain, F func)
+    {
+        size_t count = end > begin ? end - begin : 0;
+        size_t numChunks = grain > 0 ? (count + grain - 1) / grain : count;
+        if ( numThreads > (int)numChunks )
+            numThreads = (int)numChunks;
+
+        if ( numThreads <= 1 ) {
+            for (size_t i = begin; i < end; i++)
+                func(i);
+            return;
+        }
+
+        // several chunks per thread, so that an uneven split can be evened out
+        size_t chunkSize = count / ((size_t)numThreads * 8);
+        if ( chunkSize < grain )
+            chunkSize = grain;
+
+        std::atomic<size_t> next(begin);
+        auto worker = [&]() {
+            for (;;) {
+                size_t first = next.fetch_add(chunkSize);
+                if ( first >= end )
+                    break;
+                size_t last = first + chunkSize < end ? first + chunkSize : end;
+                for (size_t i = first; i < last; i++)
+                    func(i);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        threads.reserve(numThreads - 1);
+        for (int t = 1; t < numThreads; t++)
+            threads.push_back(std::thread(worker));
+        worker();
+        for (size_t t = 0; t < threads.size(); t++)
+            threads[t].join();
+    }
+
+    // A queue for handing work from one thread to another. It holds at most 'capacity' items, and push
+    // waits for room, so a producer that gets ahead is held back instead of piling up work in memory.
+    // Once the producer calls close, pop returns false when the queue is empty rather than waiting.
+    template <typename T>
+    class boundedQueue
+    {
+    public:
+        boundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1), closed(false) {}
+
+        void push(T&& item)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            notFull.wait(lock, [&]() { return items.size() < capacity || closed; });
+            if ( closed )
+                return;
+            items.push_back(std::move(item));
+            lock.unlock();
+            notEmpty.notify_one();
+        }
+
+        bool pop(T& item)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            notEmpty.wait(lock, [&]() { return ! items.empty() || closed; });
+            if ( items.empty() )
+                return false;
+            item = std::move(items.front());
+            items.pop_front();
+            lock.unlock();
+            notFull.notify_one();
+            return true;
+        }
+
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+            notEmpty.notify_all();
+            notFull.notify_all();
+        }
+
+    private:
+        size_t capacity;
+        bool closed;
+        std::deque<T> items;
+        std::mutex mutex;
+        std::condition_variable notEmpty;
+        std::condition_variable notFull;
+    };
+
+} // namespace
+
+#endif
@@ -0,0 +1,204 @@
+#include <math.h>
+#include <algorithm>
+#include "pipeline.h"
+#include "gcode.h"
+#include "parallel.h"
+
+using namespace std;
+
+namespace scv {
+
+// Finished segments on their way from the planner to the sampler. The rows are copied exactly as the
+// planner collated them, along with their start times. A scaler that is not a polynomial is measured
+// from the start of its scaler move, which is no longer in the planner by the time the sampler gets
+// to it, so that is copied too.
+template <typename F>
+struct segmentBatch {
+    segmentTable_t<F> segments;
+    std::vector<double> startTimes;
+    std::vector<vec3_t<F> > scalerSrc;
+    double endTime;             // end of the last segment
+    int firstSegment;           // index of the first segment from the start of the job
+
+    segmentBatch() {
+        endTime = 0;
+        firstSegment = 0;
+    }
+};
+
+// Everything shared between the three stages
+template <typename F>
+struct jobContext {
+    planner_t<F>* plan;
+    boundedQueue<std::vector<move_t<F> > > moveQueue;
+    boundedQueue<segmentBatch<F> > segmentQueue;
+    segmentBatch<F> filling;    // the batch the planner is adding segments to
+    size_t segmentsPerBatch;
+    int numSegments;
+
+    jobContext(size_t queueLength) : moveQueue(queueLength), segmentQueue(queueLength) {
+        plan = 0;
+        segmentsPerBatch = 0;
+        numSegments = 0;
+    }
+
+    void sendSegments() {
+        if ( filling.segments.empty() )
+            return;
+        segmentQueue.push(std::move(filling));
+        filling = segmentBatch<F>();
+    }
+};
+
+// Parser thread: hands each batch of moves to the planner
+template <typename F>
+static void queueMoves(std::vector<move_t<F> >& moves, void* userData)
+{
+    jobContext<F>* job = (jobContext<F>*)userData;
+    job->moveQueue.push(std::move(moves));
+}
+
+// Planner thread: the stream callback, which adds the segments of each finished move to the batch
+template <typename F>
+static void collectSegments(const segmentTable_t<F>& segments, double startTime, void* userData)
+{
+    jobContext<F>* job = (jobContext<F>*)userData;
+    segmentBatch<F>& b = job->filling;
+    if ( b.segments.empty() )
+        b.firstSegment = job->numSegments;
+
+    // the moves the scalers are measured along are the finished move and the one after it
+    const std::pmr::vector<move_t<F> >& moves = job->plan->moves;
+    double t = startTime;
+    for (size_t i = 0; i < segments.size(); i++) {
+        const segmentInfo_t<F>& si = segments.info[i];
+        b.startTimes.push_back(t);
+        b.scalerSrc.push_back(si.scalerIsPolynomial ? vec3_t<F>(0, 0, 0) : moves[si.scalerMove - si.moveOwner].src);
+        t += segments.duration[i];
+    }
+    b.endTime = t;
+    b.segments.replace(b.segments.size(), 0, segments);
+    job->numSegments += (int)segments.size();
+
+    if ( b.segments.size() >= job->segmentsPerBatch )
+        job->sendSegments();
+}
+
+// Sampler thread: samples batches of segments as they arrive, the same way as planner::sampleUniform.
+// Whether a segment is the last one (which takes every sample after the end of the path) is only known
+// once the next batch arrives, so the last segment of each batch is held back until then.
+template <typename F>
+class segmentSampler {
+public:
+    segmentSampler(double dt, sampleBuffers_t<F>& out, sampleCallback_t<F> callback, void* userData)
+        : dt(dt), out(out), callback(callback), userData(userData)
+    {
+        nextSample = 0;
+        numSamples = 0;
+        count = 0;
+        pendingRow = 0;
+    }
+
+    void add(segmentBatch<F>& b) {
+        while ( pendingRow < pending.segments.size() )
+            sampleSegment(pending, pendingRow++, false);
+        pending = std::move(b);
+        pendingRow = 0;
+        while ( pendingRow + 1 < pending.segments.size() )
+            sampleSegment(pending, pendingRow++, false);
+    }
+
+    void finish() {
+        if ( pending.segments.empty() )
+            return;
+
+        // up to the first sample at or beyond the end of the path
+        double endTime = ceil(pending.endTime / dt) * dt;
+        numSamples = (size_t)(endTime / dt + 0.000001) + 1;
+        sampleSegment(pending, pendingRow, true);
+
+        if ( count > 0 && callback )
+            callback(out, count, userData);
+        count = 0;
+    }
+
+private:
+    double dt;
+    sampleBuffers_t<F>& out;
+    sampleCallback_t<F> callback;
+    void* userData;
+    size_t nextSample;      // samples are at nextSample * dt
+    size_t numSamples;      // only known at the end
+    size_t count;           // samples in 'out'
+    segmentBatch<F> pending;
+    size_t pendingRow;
+
+    void sampleSegment(const segmentBatch<F>& b, size_t row, bool isLast) {
+        const segmentTable_t<F>& segments = b.segments;
+        double segmentStart = b.startTimes[row];
+        double segmentEnd = row + 1 < segments.size() ? b.startTimes[row + 1] : b.endTime;
+        int segmentInd = b.firstSegment + (int)row;
+
+        for (;;) {
+            size_t maxRun = out.capacity - count;
+            if ( isLast )
+                maxRun = min(maxRun, numSamples - nextSample);
+            size_t n = sampleSegmentRun(segments, row, segmentStart, segmentEnd, isLast, b.scalerSrc[row], segmentInd, 0.0, dt, nextSample, maxRun, out, count);
+            if ( n == 0 )
+                break;
+            count += n;
+            nextSample += n;
+
+            if ( count == out.capacity && callback ) {
+                callback(out, count, userData);
+                count = 0;
+            }
+        }
+    }
+};
+
+template <typename F>
+bool runGCodeJob(planner_t<F>& plan, const gcodeJob_t<F>& job, sampleBuffers_t<F>& out, sampleCallback_t<F> callback, void* userData)
+{
+    if ( job.sampleDt <= 0 || out.capacity == 0 || ! callback )
+        return false;
+
+    jobContext<F> context(job.queueLength);
+    context.plan = &plan;
+    context.segmentsPerBatch = max(job.segmentsPerBatch, (size_t)1);
+
+    if ( ! plan.beginStream(collectSegments<F>, &context) )
+        return false;
+
+    bool fileRead = false;
+    std::thread parser([&]() {
+        fileRead = loadGCodeFile(job.filename, job.base, job.movesPerBatch, queueMoves<F>, &context);
+        context.moveQueue.close();
+    });
+
+    std::thread sampler([&]() {
+        segmentSampler<F> s(job.sampleDt, out, callback, userData);
+        segmentBatch<F> b;
+        while ( context.segmentQueue.pop(b) )
+            s.add(b);
+        s.finish();
+    });
+
+    std::vector<move_t<F> > moves;
+    while ( context.moveQueue.pop(moves) ) {
+        for (size_t i = 0; i < moves.size(); i++)
+            plan.appendMove(moves[i]);
+    }
+    plan.endStream();
+    context.sendSegments();
+    context.segmentQueue.close();
+
+    parser.join();
+    sampler.join();
+    return fileRead;
+}
+
+template bool runGCodeJob(planner_t<float>& plan, const gcodeJob_t<float>& job, sampleBuffers_t<float>& out, sampleCallback_t<float> callback, void* userData);
+template bool runGCodeJob(planner_t<double>& plan, const gcodeJob_t<double>& job, sampleBuffers_t<double>& out, sampleCallback_t<double> callback, void* userData);
+
+} // namespace
@@ -0,0 +1,44 @@
+#ifndef SCV_PIPELINE_H
+#define SCV_PIPELINE_H
+
+#include "planner.h"
+
+namespace scv {
+
+    // Settings for runGCodeJob
+    template <typename F>
+    struct gcodeJob_t {
+        const char* filename;
+        move_t<F> base;             // limits and blend settings of the moves, and where they start (see loadGCodeFile)
+        double sampleDt;            // time between samples
+        size_t movesPerBatch;       // moves handed from the parser to the planner at a time
+        size_t segmentsPerBatch;    // segments handed from the planner to the sampler at a time
+        size_t queueLength;         // batches that can wait between two stages before the earlier one has to wait too
+
+        gcodeJob_t() {
+            filename = 0;
+            sampleDt = 0.002;
+            movesPerBatch = 1024;
+            segmentsPerBatch = 4096;
+            queueLength = 8;
+        }
+    };
+
+    typedef gcodeJob_t<scv_float> gcodeJob;
+
+    // Reads, plans and samples a G-code file in one go, without ever holding the whole path. The three
+    // stages run at the same time on their own threads: a parser thread reads batches of moves from the
+    // file, the calling thread plans them in streaming mode (see planner::beginStream), and a sampler
+    // thread samples the finished segments every job.sampleDt from time zero, up to the first sample at
+    // or after the end of the path. The samples are given to 'callback' on the sampler thread, in 'out'
+    // like sampleUniform, and are the same as calculating the whole path and sampling it, except that arcs
+    // stop at both ends (see planner::beginStream). The stages are joined by queues of limited length, so
+    // a fast stage waits for a slow one instead of reading the whole file ahead of it. The planner's
+    // limits and blend method must be set up beforehand, and anything already in it is cleared. Returns
+    // false if the file can't be read or streaming can't start.
+    template <typename F>
+    bool runGCodeJob(planner_t<F>& plan, const gcodeJob_t<F>& job, sampleBuffers_t<F>& out, sampleCallback_t<F> callback, void* userData = 0);
+
+} // namespace
+
+#endif
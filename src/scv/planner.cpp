@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <algorithm>
 #include "planner.h"
+#include "batch.h"
+#include "parallel.h"
 
 // The straight-line part of this is described here:
 // http://www.et.byu.edu/~ered/ME537/Notes/Ch5.pdf
@@ -14,7 +16,8 @@ namespace scv {
 
 // Stolen from GSL library
 // https://github.com/Starlink/gsl/blob/master/poly/solve_quadratic.c
-static int gsl_poly_solve_quadratic(scv_float a, scv_float b, scv_float c, scv_float *x0, scv_float *x1)
+template <typename F>
+static int gsl_poly_solve_quadratic(F a, F b, F c, F *x0, F *x1)
 {
   if (a == 0) /* Handle linear case */
     {
@@ -30,22 +33,22 @@ static int gsl_poly_solve_quadratic(scv_float a, scv_float b, scv_float c, scv_f
     }
 
   {
-    scv_float disc = b * b - 4 * a * c;
+    F disc = b * b - 4 * a * c;
 
     if (disc > 0)
       {
         if (b == 0)
           {
-            scv_float r = (scv_float)sqrt (-c / a);
+            F r = (F)sqrt (-c / a);
             *x0 = -r;
             *x1 =  r;
           }
         else
           {
-            scv_float sgnb = (scv_float)(b > 0 ? 1 : -1);
-            scv_float temp = -0.5f * (b + sgnb * (scv_float)sqrt (disc));
-            scv_float r1 = temp / a ;
-            scv_float r2 = c / temp ;
+            F sgnb = (F)(b > 0 ? 1 : -1);
+            F temp = -0.5f * (b + sgnb * (F)sqrt (disc));
+            F r1 = temp / a ;
+            F r2 = c / temp ;
 
             if (r1 < r2)
               {
@@ -62,8 +65,8 @@ static int gsl_poly_solve_quadratic(scv_float a, scv_float b, scv_float c, scv_f
       }
     else if (disc == 0)
       {
-        *x0 = (scv_float)( - 0.5 * b / a );
-        *x1 = (scv_float)( - 0.5 * b / a );
+        *x0 = (F)( - 0.5 * b / a );
+        *x1 = (F)( - 0.5 * b / a );
         return 2 ;
       }
     else
@@ -75,18 +78,611 @@ static int gsl_poly_solve_quadratic(scv_float a, scv_float b, scv_float c, scv_f
 
 
 
-planner::planner()
+template <typename F>
+planner_t<F>::planner_t(std::pmr::memory_resource* upstream)
+    : arena(upstream),
+      moves(&arena), segmentPool(&arena), freeSlots(&arena), segments(&arena), segmentStartTimes(&arena), segmentStartDistances(&arena),
+      moveOrder(&arena), moveStartTimes(&arena), moveEndMax(&arena), activeMoves(&arena),
+      fixedStep_startTicks(&arena), fixedStep_phase(&arena),
+      replan_inputs(&arena), moveFirstSegment(&arena), replan_ranges(&arena), replan_rows(&arena),
+      calc_corners(&arena), calc_speeds(&arena), calc_limits(&arena), calc_firstIds(&arena)
 {
     blendMethod = CBM_NONE;
-    posLimitLower = vec3_zero;
-    posLimitUpper = vec3_zero;
-    velLimit = vec3_zero;
-    accLimit = vec3_zero;
-    jerkLimit = vec3_zero;
+    posLimitLower = vec3(0, 0, 0);
+    posLimitUpper = vec3(0, 0, 0);
+    velLimit = vec3(0, 0, 0);
+    accLimit = vec3(0, 0, 0);
+    jerkLimit = vec3(0, 0, 0);
+    lookup_segmentIndex = 0;
+    interpolatedEndTime = 0;
+    streaming = false;
+    stream_callback = 0;
+    stream_userData = 0;
+    stream_firstMove = 0;
+    replan_blendMethod = CBM_NONE;
+    replan_shiftedFrom = -1;
+    numThreads = 1;
+    junctionSpeeds = false;
+    junctionMaxJump = 0;
+    replan_junctionSpeeds = false;
     resetTraverse();
+    resetTraverse_fixedStep(0);
 }
 
-bool planner::calculateMoves()
+// Drops the segments that a corner blend replaced, once both corners of the move have been blended
+template <typename F>
+static void removeSkippedSegments(move_t<F>& l)
+{
+    moveSegments_t<F>& segs = l.segments;
+    segs.resize( std::remove_if(segs.begin(), segs.end(), [](segment_t<F>& s) { return s.toDelete || s.duration <= 0; }) - segs.begin() );
+}
+
+// The number of rows collateMove will fill for a move
+template <typename F>
+static size_t countCollatedSegments(const move_t<F>& m)
+{
+    size_t n = 0;
+    for (size_t k = 0; k < m.segments.size(); k++)
+        if ( m.segments[k].duration > 0 ) // same test as collateMove
+            n++;
+    return n;
+}
+
+template <typename F>
+static void applyCornerToIncoming(move_t<F>& m0, const cornerBlend_t<F>& b);
+template <typename F>
+static void applyCornerToOutgoing(move_t<F>& m1, const cornerBlend_t<F>& b);
+
+// Smallest number of moves worth handing to another thread
+static const size_t parallelGrain = 256;
+
+// Moves whose profiles are solved together by calculateMoveBatch
+static const size_t profileBatchSize = 64;
+
+// How far the segments of an arc move can stray from the arc, as a fraction of its radius, before they
+// are split while the move still has room for more segments
+static const double arcTolerance = 0.00001;
+
+// An arc move whose radius changes by less than this fraction of it is taken to be a circle when working
+// out its limits, since that is usually rounding of the end point, and otherwise neighbouring moves would
+// each get a slightly different speed limit. Going around it is then at most 0.05% faster than the limit,
+// which is less than the pieces stray anyway.
+static const double arcRadiusRounding = 0.001;
+
+// The shape of an arc move (see move_t). A point on the arc is found from the fraction u of the way
+// along it: the angle, radius and height all change in proportion to u, and the distance along the arc
+// is length * u.
+template <typename F>
+struct arcPath {
+    F centerX, centerY;
+    F startAngle;
+    F sweep;            // radians turned, anticlockwise if positive
+    F startRadius;
+    F radiusChange;
+    F startZ;
+    F zChange;
+    F length;
+
+    arcPath() {}
+
+    arcPath(const move_t<F>& m) {
+        centerX = m.arcCenter.x;
+        centerY = m.arcCenter.y;
+        F x0 = m.src.x - centerX, y0 = m.src.y - centerY;
+        F x1 = m.dst.x - centerX, y1 = m.dst.y - centerY;
+        startAngle = (F)atan2(y0, x0);
+
+        // of the angles that end up at dst, the one closest to arcAngle
+        const double twoPi = 6.283185307179586;
+        double turn = atan2(y1, x1) - startAngle;
+        sweep = (F)(turn + twoPi * floor((m.arcAngle - turn) / twoPi + 0.5));
+
+        startRadius = (F)sqrt(x0 * x0 + y0 * y0);
+        radiusChange = (F)sqrt(x1 * x1 + y1 * y1) - startRadius;
+        startZ = m.src.z;
+        zChange = m.dst.z - m.src.z;
+        F meanRadius = startRadius + (F)0.5 * radiusChange;
+        length = (F)sqrt(meanRadius * sweep * meanRadius * sweep + zChange * zChange);
+    }
+
+    vec3_t<F> getPos(F u) const {
+        F angle = startAngle + sweep * u;
+        F radius = startRadius + radiusChange * u;
+        return vec3_t<F>(centerX + radius * (F)cos(angle), centerY + radius * (F)sin(angle), startZ + zChange * u);
+    }
+
+    // Change of position per unit of distance along the arc, which is very nearly a unit vector
+    vec3_t<F> getDir(F u) const {
+        F angle = startAngle + sweep * u;
+        F radius = startRadius + radiusChange * u;
+        F c = (F)cos(angle);
+        F s = (F)sin(angle);
+        F invLength = length > 0 ? 1 / length : 0;
+        return invLength * vec3_t<F>(radiusChange * c - radius * sweep * s, radiusChange * s + radius * sweep * c, zChange);
+    }
+
+    // Change of getDir per unit of distance along the arc, which points at the centre and is very nearly
+    // as long as the curvature
+    vec3_t<F> getTurn(F u) const {
+        F angle = startAngle + sweep * u;
+        F radius = startRadius + radiusChange * u;
+        F c = (F)cos(angle);
+        F s = (F)sin(angle);
+        F invLengthSq = length > 0 ? 1 / (length * length) : 0;
+        return invLengthSq * vec3_t<F>(-2 * radiusChange * sweep * s - radius * sweep * sweep * c, 2 * radiusChange * sweep * c - radius * sweep * sweep * s, 0);
+    }
+
+    // Curvature of the tighter end, allowing for the climb of a helix
+    F getCurvature() const {
+        if ( sweep == 0 )
+            return 0;
+        F radius = min(startRadius, startRadius + radiusChange);
+        F climb = zChange / sweep; // per radian
+        F d = radius * radius + climb * climb;
+        return d > 0 ? radius / d : 0;
+    }
+
+    // Bounds on getDir, getTurn and the change of getTurn per unit of distance, over the whole move,
+    // which are all largest where the radius is. Going along at speed v with acceleration a, the actual
+    // speed is at most v * stretch, the acceleration is a * getDir plus v^2 * getTurn, and the jerk takes
+    // up to v^3 * twist on top of the changes of those. For a circle these are 1, the curvature and the
+    // curvature squared. When the radius changes getTurn is no longer at right angles to getDir, and the
+    // change of getTurn no longer along it, by at most bendAlong and twistAcross. A change of radius within
+    // arcRadiusRounding is left out.
+    void getBounds(F* stretch, F* bend, F* bendAlong, F* twist, F* twistAcross) const {
+        F k = getCurvature();
+        *stretch = 1;
+        *bend = k;
+        *bendAlong = 0;
+        *twist = k * k;
+        *twistAcross = 0;
+        if ( zChange != 0 && sweep != 0 ) {
+            // k * sqrt(k^2 + torsion^2), worked out from the same numbers as the curvature
+            F radius = min(startRadius, startRadius + radiusChange);
+            F climb = zChange / sweep;
+            *twist = k / (F)sqrt(radius * radius + climb * climb);
+        }
+        F dr = fabs(radiusChange) > arcRadiusRounding * startRadius ? radiusChange : 0;
+        if ( dr == 0 || length <= 0 )
+            return;
+        F r = startRadius + max(dr, (F)0);
+        F rs = r * sweep;
+        F invLength = 1 / length;
+        *stretch = (F)sqrt(dr * dr + rs * rs + zChange * zChange) * invLength;
+        *bend = (F)(fabs(sweep) * sqrt(rs * rs + 4 * dr * dr)) * invLength * invLength;
+        *bendAlong = (F)fabs(dr * sweep) * invLength * invLength;
+        *twist = (F)(sweep * sweep * sqrt(rs * rs + 9 * dr * dr)) * invLength * invLength * invLength;
+        *twistAcross = 2 * (F)fabs(dr) * sweep * sweep * invLength * invLength * invLength;
+    }
+};
+
+template <typename F>
+static inline bool isArcMove(const move_t<F>& m)
+{
+    return m.arcAngle != 0;
+}
+
+// Moves without positive limits can't be calculated at all. Written so that NaN fails too.
+template <typename F>
+static bool hasMoveLimits(const move_t<F>& m)
+{
+    bool valid = true;
+    if ( ! (m.vel > 0) ) {
+        printf("Move velocity limit is not positive!\n");
+        valid = false;
+    }
+    if ( ! (m.acc > 0) ) {
+        printf("Move acceleration limit is not positive!\n");
+        valid = false;
+    }
+    if ( ! (m.jerk > 0) ) {
+        printf("Move jerk limit is not positive!\n");
+        valid = false;
+    }
+    return valid;
+}
+
+template <typename F>
+static inline bool isDwellMove(const move_t<F>& m)
+{
+    return m.dwell > 0 && ! isArcMove(m) && m.src.x == m.dst.x && m.src.y == m.dst.y && m.src.z == m.dst.z;
+}
+
+// Length of the path a move follows
+template <typename F>
+static F getMoveLength(const move_t<F>& m)
+{
+    if ( isArcMove(m) )
+        return arcPath<F>(m).length;
+    return (m.dst - m.src).Length();
+}
+
+// Unit direction of a move at its start (u = 0) or end (u = 1)
+template <typename F>
+static vec3_t<F> getMoveDirection(const move_t<F>& m, F u)
+{
+    vec3_t<F> dir = isArcMove(m) ? arcPath<F>(m).getDir(u) : m.dst - m.src;
+    dir.Normalize();
+    return dir;
+}
+
+// A move along the X axis from the origin, with the same length and speed limits as an arc move, and
+// its segments in 'storage'. The profile of the arc is worked out along this, then bent onto the arc.
+template <typename F>
+static move_t<F> getStraightenedMove(const move_t<F>& m, segment_t<F>* storage)
+{
+    move_t<F> line = m;
+    line.src = vec3_t<F>(0, 0, 0);
+    line.dst = vec3_t<F>(getMoveLength(m), 0, 0);
+    line.arcAngle = 0;
+    line.segments = moveSegments_t<F>();
+    line.segments.items = storage;
+    return line;
+}
+
+// Solves A * x = b by Gaussian elimination with partial pivoting. A is n by n and b holds 'count' right
+// hand sides, both stored row by row, and b is replaced by the solution. Returns false if A is singular.
+static bool solveLinear(double* A, double* b, int n, int count)
+{
+    double scale = 0;
+    for (int i = 0; i < n * n; i++)
+        scale = max(scale, fabs(A[i]));
+
+    for (int c = 0; c < n; c++) {
+        int pivot = c;
+        for (int r = c + 1; r < n; r++)
+            if ( fabs(A[r*n + c]) > fabs(A[pivot*n + c]) )
+                pivot = r;
+        if ( ! (fabs(A[pivot*n + c]) > 1e-14 * scale) )
+            return false;
+        if ( pivot != c ) {
+            for (int k = 0; k < n; k++)
+                std::swap(A[c*n + k], A[pivot*n + k]);
+            for (int k = 0; k < count; k++)
+                std::swap(b[c*count + k], b[pivot*count + k]);
+        }
+        for (int r = c + 1; r < n; r++) {
+            double f = A[r*n + c] / A[c*n + c];
+            for (int k = c; k < n; k++)
+                A[r*n + k] -= f * A[c*n + k];
+            for (int k = 0; k < count; k++)
+                b[r*count + k] -= f * b[c*count + k];
+        }
+    }
+    for (int r = n - 1; r >= 0; r--) {
+        for (int k = 0; k < count; k++) {
+            double sum = b[r*count + k];
+            for (int c = r + 1; c < n; c++)
+                sum -= A[r*n + c] * b[c*count + k];
+            b[r*count + k] = sum / A[r*n + r];
+        }
+    }
+    return true;
+}
+
+// Builds the segments of an arc move from those of its straightened move (see getStraightenedMove),
+// whose position along X is the distance along the arc. Each segment becomes one or more pieces, which
+// follow on from each other in position, velocity and acceleration, so the acceleration never jumps.
+// They start from the exact state on the arc, and to begin with the jerk of each piece is the change
+// of the acceleration on the arc (along it, plus v^2 towards the centre) over the piece. That drifts
+// away from the arc a little, so the jerks are then corrected to bring the pieces as close to the arc
+// as they can get (by least squares at a few points along each piece, with a little weight on keeping
+// the corrections small), while making the position, velocity and acceleration come out exactly right
+// at the end of the move. That takes at least three pieces, and no piece may end up over the jerk
+// limit. The starting jerks are within it (see getArcLimits), so a piece that would go over keeps its
+// starting jerk. The pieces stray furthest from the arc where the speed or acceleration changes
+// quickly, rather than where the arc turns the most. While the move has room, segments are split into
+// more pieces, the longest first if the end of the move does not come out right yet, and then the one
+// with the most distance to make up (its worst error times the length of its pieces), until all the
+// pieces are within arcTolerance of the radius. A piece that is still over the jerk limit can only be
+// one whose starting jerk is, which is the average jerk on the arc over the piece, so its segment is
+// split first since shorter pieces come closer to the jerk on the arc. Returns false if some piece is
+// still over the limit once the move is out of room (see straightenArcMove).
+template <typename F>
+static bool bendOntoArc(move_t<F>& m, const move_t<F>& line)
+{
+    typedef vec3_t<double> dvec3;
+    const int capacity = moveSegments_t<F>::capacity;
+    const int samples = 4;                  // points along each piece where the distance from the arc is measured
+    const int maxRows = capacity * samples;
+    const int maxSize = capacity + 3;
+
+    arcPath<F> arc(m);
+    const moveSegments_t<F>& path = line.segments;
+    int n = (int)path.size();
+    F invLength = arc.length > 0 ? 1 / arc.length : 0;
+    m.segments.clear();
+    if ( n == 0 )
+        return true;
+
+    double totalDuration = 0;
+    for (int k = 0; k < n; k++)
+        totalDuration += path[k].duration;
+    double shortPiece = 1e-6 * totalDuration;  // pieces shorter than this keep the jerk they start with
+    F curvature = arc.getCurvature();
+    double tolerance = curvature > 0 ? arcTolerance / curvature : 0;
+    double jerkLimit = m.jerk * (1 - 1e-6);   // a little under, to still be within after rounding to F
+
+    // distance along the arc, speed and acceleration at time t into segment k
+    auto getProgress = [&](int k, double t, double* s, double* v, double* a) {
+        const segment_t<F>& p = path[k];
+        *s = p.pos.x + t * (p.vel.x + t * (0.5 * p.acc.x + t * p.jerk.x / 6));
+        *v = p.vel.x + t * (p.acc.x + 0.5 * t * p.jerk.x);
+        *a = p.acc.x + t * p.jerk.x;
+    };
+    auto getArcPos = [&](int k, double t) {
+        double s, v, a;
+        getProgress(k, t, &s, &v, &a);
+        return dvec3(arc.getPos((F)(s * invLength)));
+    };
+
+    // change of position, velocity and acceleration for each unit of jerk in a piece of duration T, at
+    // time R after the end of the piece
+    auto getEffect = [](double T, double R, double* e) {
+        e[0] = T * T * T / 6 + 0.5 * T * T * R + 0.5 * T * R * R;
+        e[1] = 0.5 * T * T + T * R;
+        e[2] = T;
+    };
+
+    int pieces[capacity];           // per segment
+    double error[capacity];         // furthest any piece of each segment strays from the arc
+    bool reachedEnd = false;        // whether the pieces come out right at the end of the move
+    segment_t<F> result[capacity];
+    int numPieces = 0;
+
+    int pieceSegment[capacity];
+    double pieceStart[capacity];    // time into the segment
+    double pieceTime[capacity];     // time into the move
+    double duration[capacity];
+    dvec3 jerk[capacity];
+    dvec3 startJerk[capacity];      // before correcting
+    bool locked[capacity];          // pieces that keep the jerk they start with
+    dvec3 startPos[capacity], startVel[capacity], startAcc[capacity];
+    dvec3 endState[3], reached[3];  // position, velocity and acceleration at the end of the move
+    int corrected[capacity];        // pieces whose jerk is corrected
+    double A[maxRows][capacity];
+    dvec3 target[maxRows];          // points on the arc where the distance is measured, samples per piece
+    dvec3 offset[maxRows];
+    double K[maxSize * maxSize];
+    double x[maxSize * 3];
+
+    auto stepAlong = [&]() {
+        dvec3 p = startPos[0], v = startVel[0], a = startAcc[0];
+        for (int i = 0; i < numPieces; i++) {
+            double T = duration[i];
+            startPos[i] = p;
+            startVel[i] = v;
+            startAcc[i] = a;
+            p += T * (v + T * (0.5 * a + (T / 6) * jerk[i]));
+            v += T * (a + (0.5 * T) * jerk[i]);
+            a += T * jerk[i];
+        }
+        reached[0] = p;
+        reached[1] = v;
+        reached[2] = a;
+    };
+    auto getPiecePos = [&](int i, double t) {
+        return startPos[i] + t * (startVel[i] + t * (0.5 * startAcc[i] + (t / 6) * jerk[i]));
+    };
+
+    // fills in result and error for the current piece counts
+    auto build = [&]() {
+        numPieces = 0;
+        double moveTime = 0;
+        for (int k = 0; k < n; k++) {
+            for (int q = 0; q < pieces[k]; q++) {
+                double t0 = path[k].duration * q / pieces[k];
+                double t1 = q + 1 == pieces[k] ? path[k].duration : path[k].duration * (q + 1) / pieces[k];
+                pieceSegment[numPieces] = k;
+                pieceStart[numPieces] = t0;
+                pieceTime[numPieces] = moveTime + t0;
+                duration[numPieces] = t1 - t0;
+                numPieces++;
+            }
+            moveTime += path[k].duration;
+        }
+
+        // the state on the arc where each piece starts, and at the end of the last one
+        dvec3 prevAcc;
+        for (int i = 0; i <= numPieces; i++) {
+            int k = i < numPieces ? pieceSegment[i] : n - 1;
+            double t = i < numPieces ? pieceStart[i] : path[k].duration;
+            double s, v, a;
+            getProgress(k, t, &s, &v, &a);
+            F u = (F)(s * invLength);
+            dvec3 dir(arc.getDir(u));
+            dvec3 pos(arc.getPos(u));
+            dvec3 vel = v * dir;
+            dvec3 acc = a * dir + (v * v) * dvec3(arc.getTurn(u));
+            if ( i == 0 ) {
+                startPos[0] = pos;
+                startVel[0] = vel;
+                startAcc[0] = acc;
+            }
+            else
+                jerk[i-1] = duration[i-1] > 0 ? (1 / duration[i-1]) * (acc - prevAcc) : dvec3(0, 0, 0);
+            if ( i == numPieces ) {
+                endState[0] = pos;
+                endState[1] = vel;
+                endState[2] = acc;
+            }
+            prevAcc = acc;
+        }
+        for (int i = 0; i < numPieces; i++) {
+            startJerk[i] = jerk[i];
+            locked[i] = duration[i] <= shortPiece;
+            for (int q = 1; q <= samples; q++)
+                target[i*samples + q - 1] = getArcPos(pieceSegment[i], pieceStart[i] + duration[i] * q / samples);
+        }
+
+        // Correct the jerks. The unknowns are the corrections times totalDuration^3, and times are
+        // measured in units of totalDuration, which keeps the numbers in the matrix reasonable. The
+        // corrections minimize the squared distance from the arc at the sample points, subject to the
+        // end of the move coming out right, which is solved along with the Lagrange multipliers. A
+        // short piece can make up for a lot that way, and if that takes it over the jerk limit it
+        // keeps the jerk it started with, and the rest are corrected again without it.
+        reachedEnd = false;
+        for (;;) {
+            std::copy(startJerk, startJerk + numPieces, jerk);
+            stepAlong();
+            int numCorrected = 0;
+            for (int i = 0; i < numPieces; i++)
+                if ( ! locked[i] )
+                    corrected[numCorrected++] = i;
+            if ( numCorrected < 3 )
+                break;
+            double D = totalDuration;
+            double jerkScale = m.jerk * D * D * D;
+            double regularization = tolerance * tolerance / (jerkScale * jerkScale) * 1e4;
+            int rows = 0;
+            for (int i = 0; i < numPieces; i++) {
+                for (int q = 1; q <= samples; q++) {
+                    double t = duration[i] * q / samples;
+                    offset[rows] = target[rows] - getPiecePos(i, t);
+                    for (int c = 0; c < numCorrected; c++) {
+                        int l = corrected[c];
+                        double e[3] = { 0, 0, 0 };
+                        if ( l < i )
+                            getEffect(duration[l] / D, (pieceTime[i] + t - pieceTime[l] - duration[l]) / D, e);
+                        else if ( l == i )
+                            e[0] = (t / D) * (t / D) * (t / D) / 6;
+                        A[rows][c] = e[0];
+                    }
+                    rows++;
+                }
+            }
+
+            int size = numCorrected + 3;
+            for (int i = 0; i < size * size; i++)
+                K[i] = 0;
+            for (int r = 0; r < numCorrected; r++) {
+                for (int c = 0; c < numCorrected; c++) {
+                    double sum = 0;
+                    for (int row = 0; row < rows; row++)
+                        sum += A[row][r] * A[row][c];
+                    K[r*size + c] = sum;
+                }
+                K[r*size + r] += regularization;
+                dvec3 sum(0, 0, 0);
+                for (int row = 0; row < rows; row++)
+                    sum += A[row][r] * offset[row];
+                for (int d = 0; d < 3; d++)
+                    x[r*3 + d] = sum[d];
+            }
+            for (int c = 0; c < numCorrected; c++) {
+                int l = corrected[c];
+                double e[3];
+                getEffect(duration[l] / D, (D - pieceTime[l] - duration[l]) / D, e);
+                for (int q = 0; q < 3; q++)
+                    K[(numCorrected + q)*size + c] = K[c*size + numCorrected + q] = e[q];
+            }
+            double unit[3] = { 1, D, D * D };
+            for (int q = 0; q < 3; q++) {
+                dvec3 miss = unit[q] * (endState[q] - reached[q]);
+                for (int d = 0; d < 3; d++)
+                    x[(numCorrected + q)*3 + d] = miss[d];
+            }
+
+            if ( ! solveLinear(K, x, size, 3) )
+                break;
+            for (int c = 0; c < numCorrected; c++)
+                jerk[corrected[c]] += (1 / (D * D * D)) * dvec3(x[c*3], x[c*3 + 1], x[c*3 + 2]);
+            stepAlong();
+
+            int steepestCorrected = -1;
+            for (int c = 0; c < numCorrected; c++) {
+                int i = corrected[c];
+                if ( jerk[i].Length() > jerkLimit && (steepestCorrected < 0 || jerk[i].Length() > jerk[steepestCorrected].Length()) )
+                    steepestCorrected = i;
+            }
+            if ( steepestCorrected < 0 ) {
+                reachedEnd = true;
+                break;
+            }
+            locked[steepestCorrected] = true;
+        }
+
+        for (int k = 0; k < n; k++)
+            error[k] = 0;
+        for (int i = 0; i < numPieces; i++) {
+            segment_t<F>& piece = result[i];
+            piece.pos = vec3_t<F>(startPos[i]);
+            piece.vel = vec3_t<F>(startVel[i]);
+            piece.acc = vec3_t<F>(startAcc[i]);
+            piece.jerk = vec3_t<F>(jerk[i]);
+            piece.duration = (F)duration[i];
+
+            for (int q = 1; q <= samples; q++) {
+                double t = duration[i] * q / samples;
+                error[pieceSegment[i]] = max(error[pieceSegment[i]], (getPiecePos(i, t) - target[i*samples + q - 1]).Length());
+            }
+        }
+    };
+
+    // start with one piece per segment, and split the longest ones until there are enough to correct
+    for (int k = 0; k < n; k++)
+        pieces[k] = 1;
+    int total = n;
+    for ( ; total < capacity; total++) {
+        int usable = 0;
+        int longest = 0;
+        for (int k = 0; k < n; k++) {
+            if ( path[k].duration / pieces[k] > shortPiece )
+                usable += pieces[k];
+            if ( path[k].duration / pieces[k] > path[longest].duration / pieces[longest] )
+                longest = k;
+        }
+        if ( usable >= 3 || path[longest].duration <= 0 )
+            break;
+        pieces[longest]++;
+    }
+
+    // the piece furthest over the jerk limit, or -1 if none are
+    auto findSteepest = [&]() {
+        int steepest = -1;
+        for (int i = 0; i < numPieces; i++)
+            if ( result[i].jerk.Length() > m.jerk && (steepest < 0 || result[i].jerk.Length() > result[steepest].jerk.Length()) )
+                steepest = i;
+        return steepest;
+    };
+
+    build();
+    for ( ; total < capacity; total++) {
+        int worst = 0;
+        for (int k = 1; k < n; k++)
+            if ( error[k] > error[worst] )
+                worst = k;
+        int steepest = findSteepest();
+        int split = 0;
+        if ( ! reachedEnd && totalDuration > 0 ) {
+            // too few pieces long enough to correct within the jerk limit, so split the longest
+            for (int k = 1; k < n; k++)
+                if ( path[k].duration / pieces[k] > path[split].duration / pieces[split] )
+                    split = k;
+        }
+        else if ( steepest >= 0 )
+            split = pieceSegment[steepest];
+        else if ( error[worst] <= tolerance )
+            break;
+        else {
+            for (int k = 1; k < n; k++)
+                if ( error[k] * path[k].duration / pieces[k] > error[split] * path[split].duration / pieces[split] )
+                    split = k;
+        }
+        pieces[split]++;
+        build();
+    }
+
+    // the limits leave room for the pieces only following the arc approximately (see getArcLimits)
+    if ( findSteepest() >= 0 )
+        return false;
+    for (int i = 0; i < numPieces; i++)
+        m.segments.push_back(result[i]);
+    return true;
+}
+
+template <typename F>
+bool planner_t<F>::checkGlobalLimits()
 {
     bool invalidSettings = false;
     if ( velLimit.anyZero() ) {
@@ -101,55 +697,196 @@ bool planner::calculateMoves()
         printf("Global jerk limit has zero component!\n");
         invalidSettings = true;
     }
-    if ( invalidSettings ) {
+    return ! invalidSettings;
+}
+
+template <typename F>
+bool planner_t<F>::calculateMoves()
+{
+    if ( streaming ) {
+        printf("calculateMoves can not be used in streaming mode!\n");
+        return false;
+    }
+
+    if ( ! checkGlobalLimits() ) {
         printf("Aborting move calculation due to invalid global limits!\n");
         return false;
     }
 
     for (size_t i = 0; i < moves.size(); i++) {
-        scv::move& m = moves[i];
-        if ( m.vel <= 0 ) {
-            printf("Move velocity limit is zero!\n");
-            invalidSettings = true;
-        }
-        if ( m.acc <= 0 ) {
-            printf("Move acceleration limit is zero!\n");
-            invalidSettings = true;
-        }
-        if ( m.jerk <= 0 ) {
-            printf("Move jerk limit is zero!\n");
-            invalidSettings = true;
-        }
-        if ( invalidSettings ) {
+        if ( ! hasMoveLimits(moves[i]) ) {
             printf("Aborting move calculation due to invalid move limits!\n");
             return false;
         }
     }
 
-    for (size_t i = 0; i < moves.size(); i++) {
-        scv::move& m = moves[i];
-
-        calculateMove(m);
-
-        if ( blendMethod == CBM_CONSTANT_JERK_SEGMENTS ) {
-            if ( i > 0 && m.blendType != CBT_NONE ) {
-                move& prevMove = moves[i-1];
+    if ( canReplan() && replanChangedMoves() )
+        return true;
+
+    // Each move is calculated by itself, and a corner blend only looks at the parts of its two moves
+    // that other corners don't change (see planCorner). So the moves can all be calculated, then the
+    // corners all planned, and then each move can have the corners at either end of it applied. Each
+    // step only writes to one move, and gives exactly the same result as doing one move at a time.
+    size_t numMoves = moves.size();
+    assignAllSegmentSlots();
+    size_t numBatches = (numMoves + profileBatchSize - 1) / profileBatchSize;
+    parallelFor(0, numBatches, numThreads, parallelGrain / profileBatchSize, [&](size_t b) {
+        size_t first = b * profileBatchSize;
+        calculateMoveBatch(first, min(profileBatchSize, numMoves - first));
+    });
+
+    std::pmr::vector<cornerBlend>& corners = calc_corners;
+    corners.assign(numMoves, cornerBlend());
+    if ( blendMethod == CBM_CONSTANT_JERK_SEGMENTS ) {
+        parallelFor(1, numMoves, numThreads, parallelGrain, [&](size_t i) {
+            if ( moves[i].blendType != CBT_NONE ) {
                 bool isFirst = i == 1;
-                bool isLast = i == (moves.size()-1);
-                blendCorner( prevMove, m, isFirst, isLast );
+                bool isLast = i == (numMoves-1);
+                corners[i].valid = planCorner( moves[i-1], moves[i], isFirst, isLast, corners[i] );
             }
-        }
+        });
+    }
+
+    // Corners that can be blended are left to the blend, and the moves either side of them stay as
+    // they are. The remaining junctions depend on the moves after them, so they are found in one go.
+    if ( usesJunctionSpeeds() ) {
+        calculateJunctionSpeeds();
+        const std::pmr::vector<F>& speeds = calc_speeds;
+        parallelFor(0, numMoves, numThreads, parallelGrain, [&](size_t i) {
+            if ( speeds[i] > 0 || speeds[i+1] > 0 )
+                calculateMove(moves[i], speeds[i], speeds[i+1]);
+        });
     }
 
     if ( blendMethod == CBM_CONSTANT_JERK_SEGMENTS ) {
-        for (size_t i = 0; i < moves.size(); i++) {
+        parallelFor(0, numMoves, numThreads, parallelGrain, [&](size_t i) {
+            if ( corners[i].valid )
+                applyCornerToOutgoing(moves[i], corners[i]);
+            if ( i + 1 < numMoves && corners[i+1].valid )
+                applyCornerToIncoming(moves[i], corners[i+1]);
+            removeSkippedSegments(moves[i]);
+        });
+    }
+
+    collateSegments();
+    recordReplanInputs();
+
+    if ( blendMethod == CBM_INTERPOLATED_MOVES )
+        calculateSchedules();
+
+    return true;
+}
+
+// Remembers what everything was calculated with, so that the next calculateMoves can tell what changed
+template <typename F>
+void planner_t<F>::recordReplanInputs()
+{
+    replan_inputs.resize(moves.size());
+    for (size_t i = 0; i < moves.size(); i++)
+        replan_inputs[i] = moveInputs(moves[i]);
+    replan_blendMethod = blendMethod;
+    replan_velLimit = velLimit;
+    replan_accLimit = accLimit;
+    replan_jerkLimit = jerkLimit;
+    replan_junctionSpeeds = junctionSpeeds || usesJunctionSpeeds();
+    replan_shiftedFrom = -1;
+}
+
+// Whether calculateMoves works out junction speeds. Joins where an arc carries straight on keep moving
+// even without setJunctionSpeeds (see calculateJunctionSpeeds), so they are also needed for any arcs.
+template <typename F>
+bool planner_t<F>::usesJunctionSpeeds()
+{
+    if ( blendMethod == CBM_INTERPOLATED_MOVES )
+        return false;
+    if ( junctionSpeeds )
+        return true;
+    for (size_t i = 0; i < moves.size(); i++)
+        if ( isArcMove(moves[i]) )
+            return true;
+    return false;
+}
+
+// True if the segments from the last calculateMoves can be patched instead of starting again
+template <typename F>
+bool planner_t<F>::canReplan()
+{
+    return replan_inputs.size() == moves.size() && moveFirstSegment.size() == moves.size() + 1 &&
+           blendMethod == replan_blendMethod && velLimit == replan_velLimit &&
+           accLimit == replan_accLimit && jerkLimit == replan_jerkLimit &&
+           ! junctionSpeeds && ! replan_junctionSpeeds && // any edit can change the junction speeds of many moves
+           ! usesJunctionSpeeds();
+}
+
+// Recalculates the moves that changed since the last calculateMoves, and the moves either side of
+// them since they share a corner blend, then patches their segments into the table. Returns false
+// without doing anything if so much has changed that it's quicker to calculate everything again.
+template <typename F>
+bool planner_t<F>::replanChangedMoves()
+{
+    std::pmr::vector<std::pair<size_t, size_t> >& ranges = replan_ranges; // first and last move of each run to recalculate
+    ranges.clear();
+    size_t numChanged = 0;
+    for (size_t i = 0; i < moves.size(); i++) {
+        if ( replan_inputs[i].matches(moves[i]) )
+            continue;
+        if ( ! moves[i].segments.items )
+            return false; // added by changing 'moves' directly
+        numChanged++;
+        size_t first = i > 0 ? i - 1 : 0;
+        size_t last = min(i + 1, moves.size() - 1);
+        if ( ! ranges.empty() && first <= ranges.back().second + 1 )
+            ranges.back().second = last;
+        else
+            ranges.push_back(std::make_pair(first, last));
+    }
+
+    if ( numChanged * 4 > moves.size() )
+        return false;
+    if ( ranges.empty() && replan_shiftedFrom < 0 )
+        return true;
+
+    // Going backwards, so that patching the table for one run doesn't move the segments of the runs before it
+    bool renumber = replan_shiftedFrom >= 0;
+    for (size_t r = ranges.size(); r-- > 0; )
+        renumber |= replanMoves(ranges[r].first, ranges[r].second);
+
+    size_t firstChanged = moves.size();
+    if ( ! ranges.empty() )
+        firstChanged = ranges[0].first;
+    if ( replan_shiftedFrom >= 0 )
+        firstChanged = min(firstChanged, (size_t)replan_shiftedFrom);
+
+    // Segments after the changes may now be at a different index in the table, or belong to a move
+    // at a different index, or have a different consecutive number
+    if ( renumber ) {
+        int id = 0;
+        for (size_t i = 0; i < firstChanged; i++)
+            id += (int)moves[i].segments.size();
+
+        int row = firstChanged < moves.size() ? moveFirstSegment[firstChanged] : (int)segments.size();
+        for (size_t i = firstChanged; i < moves.size(); i++) {
             move& m = moves[i];
-            std::vector<segment>& segs = m.segments;
-            segs.erase( std::remove_if(std::begin(segs), std::end(segs), [](segment& s) { return s.toDelete || s.duration <= 0; }), segs.end());
+            moveFirstSegment[i] = row;
+            for (size_t k = 0; k < m.segments.size(); k++) {
+                if ( m.segments[k].duration > 0 ) { // same test as collateMove
+                    segmentInfo& si = segments.info[row++];
+                    si.scalerMove += (int)i - si.moveOwner;
+                    si.moveOwner = (int)i;
+                    si.consecutiveNumber = id + (int)k;
+                }
+            }
+            id += (int)m.segments.size();
         }
+        moveFirstSegment[moves.size()] = row;
     }
 
-    collateSegments();
+    updateSegmentStartTimes(firstChanged < moves.size() ? moveFirstSegment[firstChanged] : segments.size());
+
+    for (size_t r = 0; r < ranges.size(); r++)
+        for (size_t i = ranges[r].first; i <= ranges[r].second; i++)
+            replan_inputs[i] = moveInputs(moves[i]);
+    replan_shiftedFrom = -1;
 
     if ( blendMethod == CBM_INTERPOLATED_MOVES )
         calculateSchedules();
@@ -157,124 +894,697 @@ bool planner::calculateMoves()
     return true;
 }
 
-void planner::clear()
+// Recalculates moves first to last, including the corner blends either side of them, and replaces
+// their segments in the table. The moves just outside the range are needed for the blends, but are
+// only recalculated in copies, since their own segments also depend on the corner on their far side
+// which is not being redone. Returns true if the number of segments changed.
+template <typename F>
+bool planner_t<F>::replanMoves(size_t first, size_t last)
 {
-    moves.clear();
-    segments.clear();
+    int oldNumIds = 0;
+    for (size_t i = first; i <= last; i++)
+        oldNumIds += (int)moves[i].segments.size();
+
+    move before, after;
+    segment beforeSegments[moveSegments::capacity], afterSegments[moveSegments::capacity];
+    if ( first > 0 ) {
+        before = moves[first-1];
+        before.segments = moveSegments();
+        before.segments.items = beforeSegments;
+        calculateMove(before);
+    }
+    for (size_t i = first; i <= last; i++)
+        calculateMove(moves[i]);
+    if ( last + 1 < moves.size() ) {
+        after = moves[last+1];
+        after.segments = moveSegments();
+        after.segments.items = afterSegments;
+        calculateMove(after);
+    }
+
+    // moves first-1 to last+1, with the copies standing in for the ones outside the range
+    auto ms = [&](size_t i) -> move& { return i < first ? before : i > last ? after : moves[i]; };
+
+    if ( blendMethod == CBM_CONSTANT_JERK_SEGMENTS ) {
+        // corner i is between moves i-1 and i
+        for (size_t i = max(first, (size_t)1); i <= last + 1 && i < moves.size(); i++) {
+            if ( moves[i].blendType != CBT_NONE ) {
+                bool isFirst = i == 1;
+                bool isLast = i == (moves.size()-1);
+                blendCorner( ms(i-1), ms(i), isFirst, isLast );
+            }
+        }
+        for (size_t i = first; i <= last; i++)
+            removeSkippedSegments(moves[i]);
+    }
+
+    int id = 0;
+    for (size_t i = 0; i < first; i++)
+        id += (int)moves[i].segments.size();
+    F scalerStart = first > 0 ? moves[first-1].scaler : 0;
+
+    int firstRow = moveFirstSegment[first];
+    int oldNumRows = moveFirstSegment[last+1] - firstRow;
+    int newNumIds = 0;
+    size_t numRows = 0;
+    for (size_t i = first; i <= last; i++)
+        numRows += countCollatedSegments(moves[i]);
+    segmentTable& rows = replan_rows;
+    rows.resize(numRows);
+    size_t row = 0;
+    for (size_t i = first; i <= last; i++) {
+        moveFirstSegment[i] = firstRow + (int)row;
+        collateMove(rows, row, i, id + newNumIds, scalerStart);
+        row += countCollatedSegments(moves[i]);
+        newNumIds += (int)moves[i].segments.size();
+        scalerStart = moves[i].scaler;
+    }
+    segments.replace(firstRow, oldNumRows, rows);
+
+    return (int)rows.size() != oldNumRows || newNumIds != oldNumIds;
+}
+
+// The line that the scaler of a segment is interpolated along, worked out once per move
+template <typename F>
+struct scalerLine {
+    vec3_t<F> src;
+    vec3_t<F> dir;               // unit direction
+    F len;
+    F invLength;
+
+    scalerLine(const move_t<F>& m) {
+        src = m.src;
+        dir = m.dst - m.src;
+        len = dir.Length();
+        invLength = len > 0 ? 1 / len : 0; // a dwell has no length, and keeps its scaler
+        dir *= invLength;
+    }
+};
+
+// Segments that lie along the line of their scaler move (everything except corner blends) can use
+// the distance along that line instead of the distance from its start. The distance along the line is
+// a projection, and the projection of a cubic is also a cubic, so the scaler becomes a polynomial in
+// time and no square root is needed when evaluating it. The tolerances are compared squared, so that
+// checking a segment doesn't need any square roots either.
+template <typename F>
+static void setScalerPolynomial(segmentTable_t<F>& table, size_t i, const scalerLine<F>& line)
+{
+    const F tolerance = (F)0.0001;
+    const F toleranceSq = tolerance * tolerance;
+
+    segmentInfo_t<F>& si = table.info[i];
+    si.scalerIsPolynomial = true;
+    for (int k = 0; k < 4; k++)
+        si.scalerPoly[k] = 0;
+    si.scalerInvLength = 0;
+
+    if (si.scaler == 0)
+        return;
+
+    si.scalerInvLength = line.invLength;
+    F len = line.len;
+    const vec3_t<F>& dir = line.dir;
+
+    // coefficients of the position relative to the start of the move
+    vec3_t<F> c[4] = { table.getPos(i) - line.src, table.getVel(i), table.getHalfAcc(i), table.getSixthJerk(i) };
+    vec3_t<F> endOffset = table.getEndPos(i) - line.src;
+
+    bool onLine = len > 0 && dot(c[0], dir) >= -tolerance * len && dot(endOffset, dir) >= -tolerance * len;
+    for (int k = 0; k < 4 && onLine; k++) {
+        F offLineSq = cross(c[k], dir).LengthSquared();
+        if ( offLineSq > toleranceSq * (k == 0 ? len * len : c[k].LengthSquared()) )
+            onLine = false;
+    }
+
+    si.scalerIsPolynomial = onLine;
+    if ( ! onLine )
+        return;
+
+    F scale = si.scaler * si.scalerInvLength;
+    for (int k = 0; k < 4; k++)
+        si.scalerPoly[k] = scale * dot(c[k], dir);
+    si.scalerPoly[0] += si.scaler_start;
+}
+
+// The scaler along a segment of an arc move, which changes in proportion to the distance along the arc.
+// The fraction of the arc done at each end of the segment comes from the angle turned, and how fast it
+// changes there from the speed. The profile the arc was bent from is a cubic over each segment, so the
+// cubic with those ends is exact. 'turned' is the angle turned at the start of the segment, and is
+// moved on to its end.
+template <typename F>
+static void setArcScalerPolynomial(segmentTable_t<F>& table, size_t i, const arcPath<F>& arc, F& turned)
+{
+    const double pi = 3.141592653589793;
+
+    vec3_t<F> endOffset = table.getEndPos(i) - vec3_t<F>(arc.centerX, arc.centerY, 0);
+    double change = atan2(endOffset.y, endOffset.x) - (arc.startAngle + turned);
+    change -= 2 * pi * floor(change / (2 * pi) + 0.5);
+    F u0 = arc.sweep != 0 ? turned / arc.sweep : 0;
+    turned += (F)change;
+    F u1 = arc.sweep != 0 ? turned / arc.sweep : 0;
+
+    segmentInfo_t<F>& si = table.info[i];
+    si.scalerIsPolynomial = true;
+    for (int k = 0; k < 4; k++)
+        si.scalerPoly[k] = 0;
+    si.scalerInvLength = arc.length > 0 ? 1 / arc.length : 0;
+
+    if (si.scaler == 0)
+        return;
+
+    F T = table.duration[i];
+    F invLength = si.scalerInvLength;
+    F w0 = table.getVel(i).Length() / arc.getDir(u0).Length() * invLength;
+    F w1 = table.getEndVel(i).Length() / arc.getDir(u1).Length() * invLength;
+    F c[4] = { u0, w0, ((F)3 * (u1 - u0) - ((F)2 * w0 + w1) * T) / (T * T), ((F)2 * (u0 - u1) + (w0 + w1) * T) / (T * T * T) };
+    for (int k = 0; k < 4; k++)
+        si.scalerPoly[k] = si.scaler * c[k];
+    si.scalerPoly[0] += si.scaler_start;
+}
+
+// Empties a container and gives back its memory
+template <typename T>
+static void releaseVector(std::pmr::vector<T>& v)
+{
+    std::pmr::vector<T>(v.get_allocator()).swap(v);
+}
+
+// Gives a move that has just been added its own slot in segmentPool
+template <typename F>
+void planner_t<F>::giveSegmentSlot(move& m)
+{
+    m.segments = moveSegments(); // a copy of another move still refers to its slot
+
+    int slot;
+    if ( ! freeSlots.empty() ) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    else {
+        slot = (int)(segmentPool.size() / moveSegments::capacity);
+        const segment* oldPool = segmentPool.data();
+        segmentPool.resize(segmentPool.size() + moveSegments::capacity);
+        if ( segmentPool.data() != oldPool ) { // the slots of the other moves have moved too
+            for (size_t i = 0; i < moves.size(); i++) {
+                moveSegments& ms = moves[i].segments;
+                if ( ms.slot >= 0 )
+                    ms.items = &segmentPool[ms.slot * moveSegments::capacity];
+            }
+        }
+    }
+
+    m.segments.slot = slot;
+    m.segments.items = &segmentPool[slot * moveSegments::capacity];
+}
+
+// Lets the slot of a move that is being removed be used by the next move added
+template <typename F>
+void planner_t<F>::freeSegmentSlot(move& m)
+{
+    if ( m.segments.slot >= 0 )
+        freeSlots.push_back(m.segments.slot);
+    m.segments = moveSegments();
+}
+
+// Gives every move the slot matching its index, before calculating the whole path. Nothing in the old
+// slots is needed by then, and this also gives slots to any moves that were added to 'moves' directly.
+template <typename F>
+void planner_t<F>::assignAllSegmentSlots()
+{
+    segmentPool.resize(moves.size() * moveSegments::capacity);
+    freeSlots.clear();
+    for (size_t i = 0; i < moves.size(); i++) {
+        moveSegments& ms = moves[i].segments;
+        ms.slot = (int)i;
+        ms.items = &segmentPool[i * moveSegments::capacity];
+        ms.count = 0;
+    }
+}
+
+template <typename F>
+void planner_t<F>::clear()
+{
+    // Releasing the arena frees everything it pooled, so first nothing must be using it
+    releaseVector(moves);
+    releaseVector(segmentPool);
+    releaseVector(freeSlots);
+    segments.release();
+    releaseVector(segmentStartTimes);
+    releaseVector(segmentStartDistances);
+    lookup_segmentIndex = 0;
+    releaseVector(moveOrder);
+    releaseVector(moveStartTimes);
+    releaseVector(moveEndMax);
+    releaseVector(activeMoves);
+    interpolatedEndTime = 0;
+    stream_firstMove = 0;
+    releaseVector(replan_inputs);
+    releaseVector(moveFirstSegment);
+    replan_shiftedFrom = -1;
+    releaseVector(replan_ranges);
+    replan_rows.release();
+    releaseVector(calc_corners);
+    releaseVector(calc_speeds);
+    releaseVector(calc_limits);
+    releaseVector(calc_firstIds);
+    releaseVector(fixedStep_startTicks);
+    releaseVector(fixedStep_phase);
+    arena.release();
 }
 
-void planner::setCornerBlendMethod(cornerBlendMethod m)
+template <typename F>
+void planner_t<F>::setCornerBlendMethod(cornerBlendMethod m)
 {
     blendMethod = m;
 }
 
-void planner::calculateMove(move& m)
+// The speed, acceleration and jerk a move can use along its direction, from both its own limits and the global ones
+template <typename F>
+void planner_t<F>::getMoveLimits(const move& m, F* v, F* a, F* j)
 {
-    m.segments.clear();
+    if ( isArcMove(m) ) {
+        getArcLimits(m, v, a, j);
+        return;
+    }
 
-    scv::vec3 srcPos = m.src;
-    scv::vec3 dstPos = m.dst;
-    scv::vec3 ldir = dstPos - srcPos;
-    scv_float llen = ldir.Normalize();
+    vec3 ldir = m.dst - m.src;
+    ldir.Normalize();
 
-    scv::vec3 bv = getBoundedVector(ldir, velLimit);
-    scv::vec3 ba = getBoundedVector(ldir, accLimit);
-    scv::vec3 bj = getBoundedVector(ldir, jerkLimit);
+    vec3 bv = getBoundedVector(ldir, velLimit);
+    vec3 ba = getBoundedVector(ldir, accLimit);
+    vec3 bj = getBoundedVector(ldir, jerkLimit);
 
-    scv_float v = min( bv.Length(), m.vel); // target speed
-    scv_float a = min( ba.Length(), m.acc);
-    scv_float j = min( bj.Length(), m.jerk);
-    scv_float halfDistance = (scv_float) (0.5 * llen);     // half of the total distance we want to move
+    *v = min( bv.Length(), m.vel);
+    *a = min( ba.Length(), m.acc);
+    *j = min( bj.Length(), m.jerk);
+}
 
-    scv_float T = 2 * a / j;   // duration of both curve sections
-    scv_float T1 = (scv_float)(0.5 * T);    // duration of concave section
-    scv_float TL = 0;          // duration of linear asection
-    scv_float T2 = (scv_float)(0.5 * T);    // duration of convex section
+// The limits along an arc. The direction turns along the way, and the global limits are tightest when
+// going along an axis, so they are checked at both ends and wherever the arc passes an axis. Going
+// around the arc at speed v with acceleration a along it takes a centripetal acceleration of v^2 * k,
+// where k is the curvature. That is held to half of the move's limit, which caps the speed, and the
+// profile along the arc gets sqrt(3)/2 of it, so that the two together stay within the limit. The jerk
+// is the profile's own jerk and v^3 * k^2 backwards along the arc, plus 3 * v * a * k towards the centre.
+// The profile gets half of the limit and v^3 * k^2 a quarter, which caps the speed again, and the
+// acceleration is lowered where needed to keep 3 * v * a * k within half. Together those come to
+// sqrt(13)/4 of the limit, which leaves some room for the segments only following the arc approximately
+// (see bendOntoArc). A helix or a spiral uses the bounds from arcPath::getBounds in place of k and k^2,
+// and the profile is slowed to allow for the stretch. When the radius changes, the part of v^2 * k along
+// the arc comes out of the profile's share, and the parts of the jerk that are no longer at right angles
+// are each held to 0.04 of the limit, which still leaves the total within it.
+template <typename F>
+void planner_t<F>::getArcLimits(const move& m, F* v, F* a, F* j)
+{
+    arcPath<F> arc(m);
+    F bv = m.vel;
+    F ba = m.acc;
+    F bj = m.jerk;
+    auto check = [&](F u) {
+        vec3 dir = arc.getDir(u);
+        dir.Normalize();
+        bv = min(bv, getBoundedVector(dir, velLimit).Length());
+        ba = min(ba, getBoundedVector(dir, accLimit).Length());
+        bj = min(bj, getBoundedVector(dir, jerkLimit).Length());
+    };
+    check(0);
+    check(1);
+    const double quarterTurn = 1.5707963267948966;
+    double first = min(arc.startAngle, arc.startAngle + arc.sweep);
+    double last = max(arc.startAngle, arc.startAngle + arc.sweep);
+    for (double angle = ceil(first / quarterTurn) * quarterTurn; angle < last; angle += quarterTurn)
+        check((F)((angle - arc.startAngle) / arc.sweep));
+
+    F stretch, bend, bendAlong, twist, twistAcross;
+    arc.getBounds(&stretch, &bend, &bendAlong, &twist, &twistAcross);
+
+    const F share = (F)0.8660254037844386; // sqrt(3)/2
+    bv = bv / stretch;
+    F ta = share * ba / stretch;
+    if ( bend > 0 ) {
+        bv = min(bv, (F)sqrt(0.5 * ba / bend));
+        bv = min(bv, (F)cbrt(0.25 * bj / twist));
+        ta = min(ta, (F)(0.5 * bj / (3 * bv * bend)));
+    }
+    if ( bendAlong > 0 ) {
+        bv = min(bv, (F)sqrt(0.5 * share * ba / bendAlong));
+        bv = min(bv, (F)cbrt(0.04 * bj / twistAcross));
+        ta = min(ta, (share * ba - bv * bv * bendAlong) / stretch);
+        ta = min(ta, (F)(0.04 * bj / (3 * bv * bendAlong)));
+    }
+    *v = bv;
+    *a = ta;
+    *j = (F)0.5 * bj / stretch;
+}
 
+// Distance covered while changing speed from v0 to v1, with the acceleration starting and ending at
+// zero. The speed changes by dv in time 2*sqrt(dv/j) if that doesn't reach acceleration a, or dv/a + a/j
+// if it does. The profile is symmetric, so the average speed is halfway between v0 and v1.
+template <typename F>
+static double getSpeedChangeDistance(F v0, F v1, F a, F j)
+{
+    double dv = fabs((double)v1 - v0);
+    double T = dv * j >= (double)a * a ? dv / a + (double)a / j : 2 * sqrt(dv / j);
+    return 0.5 * ((double)v0 + v1) * T;
+}
 
-    // Values at the start of each segment. These will be updated as we go to keep track of the overall progress.
-    //    ps = starting position
-    //    vs = starting velocity
-    //    as = starting acceleration
-    // They're all zero for the first segment, so let's set them for the second segment (the end of first the segment).
-    scv_float t = T1;
-    scv_float ps = (scv_float)((j * t * t * t) / 6.0);
-    scv_float vs = (scv_float)((j * t * t) / 2.0);
-    scv_float as = (j * t);
-
-
-    scv_float dvInCurve = (a*a) / (2*j);   // change in velocity caused by a curve segment
-    scv_float v1 = 0 + dvInCurve;          // velocity at end of concave curve
-    scv_float v2 = v - dvInCurve;          // velocity at start of convex curve
-
-    if ( v1 > v2 ) {
-        // Fully performing both curve segments would exceed the velocity set-point.
-        // Need to reduce the time spent in each curve segment.
-        // Alter T1,T2 such that the concave and convex segments meet with a tangential transition.
-        T = (scv_float)sqrt(4*v*j) / j;
-        T1 = (j * T) / (2 * j);
-        T2 = T - T1;
-
-        // recalculate values for end of first segment
-        t = T1;
-        ps = (scv_float)((j * t * t * t) / 6.0);
-        vs = (scv_float)((j * t * t) / 2.0);
-        as = (j * t);
-    }
-    else if ( v2 > v1 ) {
-        // The velocity change due to the curve segments is not enough to reach the set-point velocity.
-        // Add a linear segment in between them where velocity will change with a constant acceleration.
-        scv_float vr = v2 - v1; // remaining velocity to make up
-        TL = vr / as;        // duration of linear segment
-
-        // The inserted linear segment must not cause the required distance to be exceeded.
-        // First, find out the total distance of all three segments:
-        //     led = ss + vs * TL + as * TL * TL / 2.0;                                         distance at end of linear phase
-        //     lev = vs + (as * TL);                                                            velocity at end of linear phase
-        //     tot = led + (lev * T2) + ((as * T2 * T2) / 2.0) - ((j * T2 * T2 * T2) / 6.0);    distance at end of convex segment
-        // These condense down to:
-        //     tot =   0.5 * j * t * TL * TL   + 1.5 * j * t * t * TL   + j * t * t * t;
-        // which is a quadratic equation for TL.
-
-        scv_float totalDistance =  (scv_float)( 0.5 * j * t * TL * TL   + 1.5 * j * t * t * TL   + j * t * t * t );
-
-        if ( totalDistance > halfDistance ) {
-            scv_float qa = (scv_float)(0.5 * j * t);
-            scv_float qb = (scv_float)(1.5 * j * t * t);
-            scv_float qc = j * t * t * t       - halfDistance;
-            scv_float x0 = -99999;
-            scv_float x1 = -99999;
-            gsl_poly_solve_quadratic( qa, qb, qc, &x0, &x1 );
-            scv_float bestSolution = max(x0, x1);
-            if ( bestSolution >= 0 )
-                TL = bestSolution;
+// The highest speed (up to vmax) that can be reached from speed u within distance d, which is also the
+// highest speed that can slow down to u within d. This is getSpeedChangeDistance solved for v1, which is
+// a cubic in sqrt(dv) if full acceleration is not reached, or a quadratic in dv if it is.
+template <typename F>
+static F getReachableSpeed(F u, F d, F vmax, F a, F j)
+{
+    if ( d <= 0 )
+        return min(u, vmax);
+
+    double dvFull = (double)a * a / j;                  // smallest change of speed that reaches full acceleration
+    double dFull = (2 * (double)u + dvFull) * a / j;    // distance covered by that change
+    double dv;
+    if ( d <= dFull ) {
+        // s^3 + 2u*s - d*sqrt(j) = 0 where s = sqrt(dv), which has only one real root
+        double p = 2 * (double)u;
+        double q = d * sqrt((double)j);
+        double r = sqrt(q * q / 4 + p * p * p / 27);
+        double root = cbrt(q / 2 + r) + cbrt(q / 2 - r);
+        dv = root * root;
+    }
+    else {
+        // dv^2 + (a^2/j + 2u)*dv + 2u*a^2/j - 2a*d = 0
+        double b = dvFull + 2 * (double)u;
+        double c = 2 * (double)u * dvFull - 2 * (double)a * d;
+        dv = 0.5 * (-b + sqrt(b * b - 4 * c));
+    }
+    return (F)min((double)vmax, u + dv);
+}
+
+// Adds a constant jerk segment to the move starting from distance ps along it, with speed vs and
+// acceleration as, then advances those to the end of the segment
+template <typename F>
+static void appendMoveSegment(move_t<F>& m, const vec3_t<F>& ldir, F& ps, F& vs, F& as, F j, F duration)
+{
+    segment_t<F> s;
+    s.pos = m.src + ps * ldir;
+    s.vel = vs * ldir;
+    s.acc = as * ldir;
+    s.jerk = j * ldir;
+    s.duration = duration;
+    m.segments.push_back(s);
+
+    F t = duration;
+    ps += (vs * t) + ((as * t * t) / (F)2.0) + ((j * t * t * t) / (F)6.0);
+    vs += (as * t) + ((j * t * t) / (F)2.0);
+    as += j * t;
+}
+
+// Adds the segments to change speed from vs to v1, as a concave curve, a constant acceleration phase
+// (if full acceleration is reached) and a convex curve
+template <typename F>
+static void appendSpeedChange(move_t<F>& m, const vec3_t<F>& ldir, F& ps, F& vs, F v1, F a, F j)
+{
+    F dv = (F)fabs(v1 - vs);
+    if ( dv == 0 )
+        return;
+    if ( v1 < vs )
+        j = -j;
+
+    F TC;       // duration of each curve
+    F TL = 0;   // duration of constant acceleration
+    if ( dv * (F)fabs(j) >= a * a ) {
+        TC = a / (F)fabs(j);
+        TL = dv / a - TC;
+    }
+    else
+        TC = (F)sqrt(dv / fabs(j));
+
+    F as = 0;
+    appendMoveSegment(m, ldir, ps, vs, as, j, TC);
+    if ( TL > 0 )
+        appendMoveSegment(m, ldir, ps, vs, as, (F)0, TL);
+    appendMoveSegment(m, ldir, ps, vs, as, -j, TC);
+    vs = v1; // rather than carrying the rounding error on
+}
+
+// Profile for a move that starts or ends moving: speed up (or down) from the entry speed to a peak
+// speed, cruise, then change to the exit speed. The junction speeds were chosen so that the entry
+// and exit speeds can always be joined within the length of the move, so the peak speed is at least
+// the higher of them, and the highest that fits below the move's speed limit.
+template <typename F>
+static void calculateNonStopMove(move_t<F>& m, const vec3_t<F>& ldir, F llen, F v, F a, F j)
+{
+    F v0 = m.entryVel;
+    F v1 = m.exitVel;
+
+    // The distance needed rises with the peak speed, so the peak is found by false position (Illinois
+    // variant). It can't be more than the speed reachable from the higher end speed within the whole
+    // move, and if both end speeds are the same it's the speed reachable within half the move, so that
+    // is the first guess. Near the lower end the distance goes up with the square root of the peak speed
+    // above it, so the search is done on that square root instead, where the distance is much closer to
+    // a straight line. The lower end always fits, and any distance left over is taken up by cruising, so
+    // it only needs to get close to using the full length.
+    F peak = v;
+    double fhi = getSpeedChangeDistance(v0, v, a, j) + getSpeedChangeDistance(v, v1, a, j) - llen;
+    if ( fhi > 0 ) {
+        F base = max(v0, v1);
+        F upper = getReachableSpeed(base, llen, v, a, j);
+        F guess = getReachableSpeed(base, (F)0.5 * llen, v, a, j);
+        double lo = 0;
+        double hi = sqrt((double)upper - base);
+        double flo = getSpeedChangeDistance(v0, base, a, j) + getSpeedChangeDistance(base, v1, a, j) - llen;
+        fhi = getSpeedChangeDistance(v0, upper, a, j) + getSpeedChangeDistance(upper, v1, a, j) - llen;
+        int side = 0;
+        for (int i = 0; i < 30 && flo < -0.000001 * llen && fhi > 0; i++) {
+            double mid = i == 0 ? sqrt((double)guess - base) : lo - flo * (hi - lo) / (fhi - flo);
+            if ( ! (mid > lo && mid < hi) )
+                mid = 0.5 * (lo + hi);
+            F midSpeed = (F)(base + mid * mid);
+            double f = getSpeedChangeDistance(v0, midSpeed, a, j) + getSpeedChangeDistance(midSpeed, v1, a, j) - llen;
+            if ( f > 0 ) {
+                hi = mid;
+                fhi = f;
+                if ( side == 1 )
+                    flo *= 0.5;
+                side = 1;
+            }
+            else {
+                lo = mid;
+                flo = f;
+                if ( side == -1 )
+                    fhi *= 0.5;
+                side = -1;
+            }
+        }
+        peak = (F)(base + (fhi > 0 ? lo * lo : hi * hi));
+    }
+
+    F ps = 0;
+    F vs = v0;
+    appendSpeedChange(m, ldir, ps, vs, peak, a, j);
+
+    F cruiseDistance = llen - (ps + (F)getSpeedChangeDistance(peak, v1, a, j));
+    if ( cruiseDistance > 0.000001 && peak > 0 ) {
+        F as = 0;
+        appendMoveSegment(m, ldir, ps, vs, as, (F)0, cruiseDistance / peak);
+    }
+
+    appendSpeedChange(m, ldir, ps, vs, v1, a, j);
+}
+
+// Finds the speed at the start of each move when junction speeds are used, with one more entry for the
+// end of the path. Each junction starts at the highest speed both moves allow, then a backward pass
+// lowers them so that every move can slow down in time for the next junction, and a forward pass so
+// that every move can speed up to them. The path still starts and ends at rest, and so does any move
+// with zero length or CBT_NONE. A blend needs the constant speed part of both its moves to be around
+// their middle, which is only the case for moves that start and end at rest, so the moves either side
+// of a corner in 'corners' that will be blended also stay at rest. Without setJunctionSpeeds, only the
+// joins next to an arc are given a speed, and only where the direction carries straight on (eg. between
+// the moves of a G2/G3 that was split up), since arcs are never blended and would stop there otherwise.
+template <typename F>
+void planner_t<F>::calculateJunctionSpeeds()
+{
+    const std::pmr::vector<cornerBlend>& corners = calc_corners;
+    std::pmr::vector<F>& speeds = calc_speeds;
+    std::pmr::vector<moveLimits>& limits = calc_limits;
+    size_t numMoves = moves.size();
+    speeds.assign(numMoves + 1, 0);
+
+    limits.resize(numMoves);
+    for (size_t i = 0; i < numMoves; i++) {
+        limits[i].length = getMoveLength(moves[i]);
+        getMoveLimits(moves[i], &limits[i].vel, &limits[i].acc, &limits[i].jerk);
+    }
+
+    // a move touching a blended corner is at rest at both ends
+    auto atRest = [&](size_t i) { return corners[i].valid || (i + 1 < numMoves && corners[i+1].valid); };
+
+    F maxJump = junctionSpeeds ? junctionMaxJump : 0;
+    for (size_t i = 1; i < numMoves; i++) {
+        if ( atRest(i-1) || atRest(i) || moves[i].blendType == CBT_NONE || limits[i-1].length < 0.000001 || limits[i].length < 0.000001 )
+            continue;
+        if ( ! junctionSpeeds && ! isArcMove(moves[i-1]) && ! isArcMove(moves[i]) )
+            continue;
+
+        vec3 d0 = getMoveDirection(moves[i-1], (F)1);
+        vec3 d1 = getMoveDirection(moves[i], (F)0);
+
+        // passing through at speed s changes the velocity by s * (d1 - d0)
+        F jumpPerSpeed = (d1 - d0).Length();
+        F limit = min(limits[i-1].vel, limits[i].vel);
+        if ( jumpPerSpeed > 0.00001 )
+            limit = min(limit, maxJump / jumpPerSpeed);
+        speeds[i] = limit;
+    }
+
+    for (size_t i = numMoves; i-- > 0; ) {
+        const moveLimits& l = limits[i];
+        speeds[i] = min(speeds[i], getReachableSpeed(speeds[i+1], l.length, l.vel, l.acc, l.jerk));
+    }
+    for (size_t i = 0; i < numMoves; i++) {
+        const moveLimits& l = limits[i];
+        speeds[i+1] = min(speeds[i+1], getReachableSpeed(speeds[i], l.length, l.vel, l.acc, l.jerk));
+    }
+}
+
+// Calculates the segments of a single move. Moves start and end at rest unless given an entry or exit speed.
+template <typename F>
+void planner_t<F>::calculateMove(move& m, F entryVel, F exitVel)
+{
+    m.segments.clear();
+    m.entryVel = entryVel;
+    m.exitVel = exitVel;
+
+    F v, a, j; // target speed, acceleration and jerk
+    getMoveLimits(m, &v, &a, &j);
+
+    if ( entryVel > 0 || exitVel > 0 ) {
+        if ( isArcMove(m) ) {
+            segment lineSegments[moveSegments::capacity];
+            move line = getStraightenedMove(m, lineSegments);
+            calculateNonStopMove(line, vec3(1, 0, 0), line.dst.x, v, a, j);
+            if ( ! bendOntoArc(m, line) )
+                straightenArcMove(m);
+            return;
         }
+        vec3 ldir = m.dst - m.src;
+        F llen = ldir.Normalize();
+        calculateNonStopMove(m, ldir, llen, v, a, j);
+        return;
     }
 
+    // solved as a batch of one, so that it comes out the same as when calculateMoveBatch does it
+    F llen = getMoveLength(m);
+    F T1, TL, T2;
+    solveProfileBatch(&llen, &v, &a, &j, 1, &T1, &TL, &T2);
+    appendMoveProfile(m, v, j, T1, TL, T2);
+}
+
+// The last resort for an arc whose pieces can't be kept within the jerk limit, even at a lower speed
+// when that is possible (see bendOntoArc): the move goes straight to its end instead.
+template <typename F>
+void planner_t<F>::straightenArcMove(move& m)
+{
+    printf("Arc move can't be kept within its jerk limit, going straight instead\n");
+    move chord = m;
+    chord.arcAngle = 0;
+    chord.segments.clear();
+    if ( chord.src == chord.dst )
+        calculateMove(chord); // a whole turn, which has nowhere to go
+    else
+        calculateMove(chord, m.entryVel, m.exitVel);
+    m.segments.count = chord.segments.count;
+}
+
+// Calculates the segments of 'count' consecutive moves starting at 'first', which all start and end at
+// rest. The durations for all of them are found together by solveProfileBatch, which handles several
+// moves per instruction, then the segments are built from those one move at a time.
+template <typename F>
+void planner_t<F>::calculateMoveBatch(size_t first, size_t count)
+{
+    F length[profileBatchSize], vel[profileBatchSize], acc[profileBatchSize], jerk[profileBatchSize];
+    F T1[profileBatchSize], TL[profileBatchSize], T2[profileBatchSize];
+
+    while ( count > 0 ) {
+        size_t n = min(count, profileBatchSize);
+        for (size_t i = 0; i < n; i++) {
+            move& m = moves[first + i];
+            m.segments.clear();
+            m.entryVel = 0;
+            m.exitVel = 0;
+            length[i] = getMoveLength(m);
+            getMoveLimits(m, &vel[i], &acc[i], &jerk[i]);
+        }
+
+        solveProfileBatch(length, vel, acc, jerk, n, T1, TL, T2);
 
-    double bothCurvesDistance = (j * t * t * t);    // distance traveled during both concave and convex segments, if no linear phase involved
-    if ( bothCurvesDistance > halfDistance ) {
-        // Distance required is too short to allow fully performing both curves.
-        // Reduce the time allowed in each curve. No linear phases will be used anywhere.
+        for (size_t i = 0; i < n; i++)
+            appendMoveProfile(moves[first + i], vel[i], jerk[i], T1[i], TL[i], T2[i]);
 
-        T = (scv_float)cbrt( halfDistance / j );     // this is the bothCurvesDistance equation above, solved for t
-        T1 = T2 = T;    // same duration for both concave and convex curves
-        TL = 0;
+        first += n;
+        count -= n;
+    }
+}
+
+// Builds the segments of a move that starts and ends at rest, from the segment durations found by
+// solveProfileBatch. 'v' and 'j' are the speed and jerk limits the durations were found with.
+template <typename F>
+void planner_t<F>::appendMoveProfile(move& m, F v, F j, F T1, F TL, F T2)
+{
+    if ( isDwellMove(m) ) {
+        segment s;
+        s.pos = m.src;
+        s.vel = vec3(0, 0, 0);
+        s.acc = vec3(0, 0, 0);
+        s.jerk = vec3(0, 0, 0);
+        s.duration = m.dwell;
+        m.segments.push_back(s);
+        return;
+    }
+
+    if ( isArcMove(m) ) {
+        segment lineSegments[moveSegments::capacity];
+        move line = getStraightenedMove(m, lineSegments);
+        appendMoveProfile(line, v, j, T1, TL, T2);
+        if ( bendOntoArc(m, line) )
+            return;
 
-        // recalculate values for end of first segment
-        t = T1;
-        ps = (scv_float)((j * t * t * t) / 6.0);
-        vs = (scv_float)((j * t * t) / 2.0);
-        as = (j * t);
+        // Halving all the limits at least halves every part of the jerk on the arc
+        F len = line.dst.x;
+        F a;
+        getMoveLimits(m, &v, &a, &j);
+        for (int tries = 0; tries < 4; tries++) {
+            v *= (F)0.5;
+            a *= (F)0.5;
+            j *= (F)0.5;
+            solveProfileBatch(&len, &v, &a, &j, 1, &T1, &TL, &T2);
+            line.segments.clear();
+            appendMoveProfile(line, v, j, T1, TL, T2);
+            if ( bendOntoArc(m, line) )
+                return;
+        }
+        straightenArcMove(m);
+        return;
     }
 
-    scv::vec3 origin = srcPos;
+    vec3 srcPos = m.src;
+    vec3 dstPos = m.dst;
+    vec3 ldir = dstPos - srcPos;
+    F llen = ldir.Normalize();
+
+    // Values at the start of each segment. These will be updated as we go to keep track of the overall progress.
+    //    ps = starting position
+    //    vs = starting velocity
+    //    as = starting acceleration
+    // They're all zero for the first segment, so let's set them for the second segment (the end of first the segment).
+    F t = T1;
+    F ps = (F)((j * t * t * t) / 6.0);
+    F vs = (F)((j * t * t) / 2.0);
+    F as = (j * t);
+
+    vec3 origin = srcPos;
 
     // segment 1, concave rising
     segment c1;
     c1.pos = origin;
-    c1.vel = scv::vec3_zero;
-    c1.acc = scv::vec3_zero;
+    c1.vel = vec3(0, 0, 0);
+    c1.acc = vec3(0, 0, 0);
     c1.jerk = j * ldir;
     c1.duration = T1;
     m.segments.push_back(c1);
@@ -287,12 +1597,12 @@ void planner::calculateMove(move& m)
         c2.pos = origin + ps * ldir;
         c2.vel = vs * ldir;
         c2.acc = as * ldir;
-        c2.jerk = scv::vec3_zero;
+        c2.jerk = vec3(0, 0, 0);
         c2.duration = TL;
         m.segments.push_back(c2);
 
         t = TL;
-        ps += (vs * t) + (as * t * t) / (scv_float)2.0;
+        ps += (vs * t) + (as * t * t) / (F)2.0;
         vs += (as * t);
     }
 
@@ -306,24 +1616,24 @@ void planner::calculateMove(move& m)
     m.segments.push_back(c3);
 
     t = T2;
-    ps += (vs * t) + ((as * t * t) / (scv_float)2.0) - ((j * t * t * t) / (scv_float)6.0);
-    vs += ((j * t * t) / (scv_float)2.0);
+    ps += (vs * t) + ((as * t * t) / (F)2.0) - ((j * t * t * t) / (F)6.0);
+    vs += ((j * t * t) / (F)2.0);
     as = 0;
 
     // segment 4, constant velocity linear phase (maybe)
-    scv_float totalRiseDistance = 2 * ps;
-    scv_float remainingDistance = llen - totalRiseDistance;
+    F totalRiseDistance = 2 * ps;
+    F remainingDistance = llen - totalRiseDistance;
     if ( remainingDistance > 0.000001 ) {
 
         segment c4;
         c4.pos = origin + ps * ldir;
         c4.vel = vs * ldir;
-        c4.acc = scv::vec3_zero;
-        c4.jerk = scv::vec3_zero;
+        c4.acc = vec3(0, 0, 0);
+        c4.jerk = vec3(0, 0, 0);
         c4.duration = remainingDistance / v;
         m.segments.push_back(c4);
 
-        ps += vs * (scv_float)c4.duration; // a nice simple calculation for a change
+        ps += vs * (F)c4.duration; // a nice simple calculation for a change
     }
 
     // segment 5, convex falling
@@ -336,8 +1646,8 @@ void planner::calculateMove(move& m)
     m.segments.push_back(c5);
 
     t = T2;
-    ps += (vs * t) + ((as * t * t) / (scv_float)2.0) + (-j * t * t * t) / (scv_float)6.0;
-    vs += (-j * t * t) / (scv_float)2.0;
+    ps += (vs * t) + ((as * t * t) / (F)2.0) + (-j * t * t * t) / (F)6.0;
+    vs += (-j * t * t) / (F)2.0;
     as += (-j * t);
 
     // segment 6, falling linear phase (maybe)
@@ -346,12 +1656,12 @@ void planner::calculateMove(move& m)
         c6.pos = origin + ps * ldir;
         c6.vel = vs * ldir;
         c6.acc = as * ldir;
-        c6.jerk = scv::vec3_zero;
+        c6.jerk = vec3(0, 0, 0);
         c6.duration = TL;
         m.segments.push_back(c6);
 
         t = TL;
-        ps += (vs * t) + (as * t * t) / (scv_float)2.0;
+        ps += (vs * t) + (as * t * t) / (F)2.0;
         vs += (as * t);
     }
 
@@ -365,17 +1675,20 @@ void planner::calculateMove(move& m)
     m.segments.push_back(c7);
 }
 
-void planner::calculateSchedules() {
+template <typename F>
+void planner_t<F>::calculateSchedules() {
 
-    if ( moves.empty() )
+    if ( moves.empty() ) {
+        buildMoveIndex();
         return;
+    }
 
     for (size_t i = 0; i < moves.size(); i++) {
         move& m = moves[i];
         m.duration = 0;
         for (size_t k = 0; k < m.segments.size(); k++) {
             segment& s = m.segments[k];
-            m.duration += (scv_float)s.duration;
+            m.duration += (F)s.duration;
         }
     }
 
@@ -388,136 +1701,382 @@ void planner::calculateSchedules() {
         move& m0 = moves[i-1];
         move& m1 = moves[i];
 
-        if ( m1.blendType == CBT_NONE ) {
+        if ( m1.blendType == CBT_NONE || isDwellMove(m0) || isDwellMove(m1) ) {
             m1.scheduledTime = m0.scheduledTime + m0.duration;
             lastMoveHadNoBlend = true;
             continue;
         }
 
         bool isFirst = i == 1 || lastMoveHadNoBlend;
-        bool isLast = (i == moves.size()-1) || ((i < moves.size()-1) && (moves[i+1].blendType == CBT_NONE));
+        bool isLast = (i == moves.size()-1) || ((i < moves.size()-1) && (moves[i+1].blendType == CBT_NONE || isDwellMove(moves[i+1])));
 
         lastMoveHadNoBlend = false;
 
-        scv_float rampDuration0 = m0.segments[0].duration + m0.segments[1].duration;
-        scv_float rampDuration1 = m1.segments[0].duration + m1.segments[1].duration;
+        F rampDuration0 = m0.segments[0].duration + m0.segments[1].duration;
+        F rampDuration1 = m1.segments[0].duration + m1.segments[1].duration;
         if ( m0.segments.size() == 7 )
             rampDuration0 += m0.segments[2].duration;
         if ( m1.segments.size() == 7 )
             rampDuration1 += m1.segments[2].duration;
 
-        float allowableFraction0 = isFirst ? (scv_float)0.99 : (scv_float)0.5;
-        float allowableFraction1 = isLast  ? (scv_float)0.99 : (scv_float)0.5;
+        F allowableFraction0 = isFirst ? (F)0.99 : (F)0.5;
+        F allowableFraction1 = isLast  ? (F)0.99 : (F)0.5;
 
-        allowableFraction0 = min(allowableFraction0, maxOverlapFraction);
-        allowableFraction1 = min(allowableFraction1, maxOverlapFraction);
+        allowableFraction0 = min(allowableFraction0, (F)maxOverlapFraction);
+        allowableFraction1 = min(allowableFraction1, (F)maxOverlapFraction);
 
-        float allowableDuration0 = allowableFraction0 * m0.duration;
-        float allowableDuration1 = allowableFraction1 * m1.duration;
+        F allowableDuration0 = allowableFraction0 * m0.duration;
+        F allowableDuration1 = allowableFraction1 * m1.duration;
 
-        //scv_float blendTime = max(rampDuration0, rampDuration1);
+        //F blendTime = max(rampDuration0, rampDuration1);
         //blendTime = min(blendTime, min(allowableDuration0,allowableDuration1));
-        scv_float blendTime = min(allowableDuration0,allowableDuration1);
+        F blendTime = min(allowableDuration0,allowableDuration1);
 
         if ( blendTime > 0 )
             m1.scheduledTime = m0.scheduledTime + m0.duration - blendTime;
     }
 
+    buildMoveIndex();
 }
 
-void planner::getSegmentState(segment& s, scv_float t, vec3* pos, vec3* vel, vec3* acc, vec3* jerk, scv_float *scaler)
+// Sorts the moves by scheduled start time and records the running maximum of their end times, so that
+// the moves active at any time can be found without looking through all of them. This is used with
+// CBM_INTERPOLATED_MOVES, where moves overlap each other.
+template <typename F>
+void planner_t<F>::buildMoveIndex()
 {
-    *pos = s.pos + (t * s.vel) + ((t * t) / (scv_float)2.0) * s.acc + ((t * t * t) / (scv_float)6.0) * s.jerk;
-    *vel = s.vel + (t * s.acc) + ((t * t) / (scv_float)2.0) * s.jerk;
-    *acc = s.acc + t * s.jerk;
-    *jerk = s.jerk;
+    moveOrder.clear();
+    moveStartTimes.clear();
+    moveEndMax.clear();
+    interpolatedEndTime = 0;
 
-    if (s.scaler != 0)
-    {
-        auto dist = (s.pos + (t * s.vel) + ((t * t) / (scv_float)2.0) * s.acc + ((t * t * t) / (scv_float)6.0) * s.jerk);
-        dist = dist - s.startPos;
-        auto totalDist = s.endPos - s.startPos;
-        *scaler = s.scaler_start + (s.scaler * dist.Length() / totalDist.Length());
-     }
-    else
-    {
-        *scaler = 0;
+    for (size_t i = 0; i < moves.size(); i++) {
+        moveOrder.push_back((int)i);
+        move& m = moves[i];
+        F mEnd = m.scheduledTime + m.duration;
+        if ( mEnd > interpolatedEndTime )
+            interpolatedEndTime = mEnd;
+    }
+
+    // A move with an invalid (NaN) schedule never fails the range check in getTrajectoryState_interpolatedMoves,
+    // so it is indexed as starting before and ending after everything else.
+    auto startKey = [this](int i) { F t = moves[i].scheduledTime; return t == t ? t : -INFINITY; };
+    // Moves starting at the same time stay in index order. This is what stable_sort would do, but
+    // stable_sort needs a temporary buffer.
+    auto earlierStart = [&startKey](int a, int b) { F ta = startKey(a), tb = startKey(b); return ta < tb || (ta == tb && a < b); };
+
+    // moves are usually scheduled in order already
+    if ( ! std::is_sorted(moveOrder.begin(), moveOrder.end(), earlierStart) )
+        std::sort(moveOrder.begin(), moveOrder.end(), earlierStart);
+
+    F endMax = -INFINITY;
+    for (size_t k = 0; k < moveOrder.size(); k++) {
+        move& m = moves[moveOrder[k]];
+        F mEnd = m.scheduledTime + m.duration;
+        endMax = max(endMax, mEnd == mEnd ? mEnd : INFINITY);
+        moveStartTimes.push_back(startKey(moveOrder[k]));
+        moveEndMax.push_back(endMax);
+    }
+}
+
+// Collects the indices of the moves whose schedule contains time t into activeMoves, in
+// ascending order. Moves that start after t are skipped by binary search, and the search
+// back from there stops as soon as no earlier move can still be running.
+template <typename F>
+int planner_t<F>::findActiveMoves(F t)
+{
+    activeMoves.clear();
+
+    int k = (int)(std::upper_bound(moveStartTimes.begin(), moveStartTimes.end(), t) - moveStartTimes.begin()) - 1;
+    for (; k >= 0 && moveEndMax[k] >= t; k--) {
+        move& m = moves[moveOrder[k]];
+        F mEnd = m.scheduledTime + m.duration;
+        if ( ! (t < m.scheduledTime || t > mEnd) )
+            activeMoves.push_back(moveOrder[k]);
     }
+
+    std::sort(activeMoves.begin(), activeMoves.end());
+    return (int)activeMoves.size();
+}
+
+template <typename F>
+void planner_t<F>::getSegmentState(int segmentInd, F t, vec3* pos, vec3* vel, vec3* acc, vec3* jerk, F *scaler)
+{
+    vec3 c1 = segments.getVel(segmentInd);
+    vec3 c2 = segments.getHalfAcc(segmentInd);
+    vec3 c3 = segments.getSixthJerk(segmentInd);
+    segments.getPosition(segmentInd, t, pos);
+    *vel = c1 + t * ((F)2 * c2 + t * ((F)3 * c3));
+    *acc = (F)2 * c2 + t * ((F)6 * c3);
+    *jerk = (F)6 * c3;
+    *scaler = getSegmentScaler(segmentInd, t, *pos);
     //*scaler = s.scaler + s.scaler_rate * t;
 }
 
-void getSegmentPosition(segment& s, scv_float t, scv::vec3* pos )
+// Same as getSegmentState at the end of the segment, using the stored end values
+template <typename F>
+void planner_t<F>::getSegmentEndState(int segmentInd, vec3* pos, vec3* vel, vec3* acc, vec3* jerk, F* scaler)
+{
+    *pos = segments.getEndPos(segmentInd);
+    *vel = segments.getEndVel(segmentInd);
+    *acc = segments.getAcc(segmentInd) + segments.duration[segmentInd] * segments.getJerk(segmentInd);
+    *jerk = segments.getJerk(segmentInd);
+    *scaler = getSegmentScaler(segmentInd, segments.duration[segmentInd], *pos);
+}
+
+// Scaler value at time t within the segment, where the position is pos
+template <typename F>
+F planner_t<F>::getSegmentScaler(int segmentInd, F t, const vec3& pos)
+{
+    const segmentInfo& si = segments.info[segmentInd];
+    if (si.scalerIsPolynomial)
+        return evaluateSegmentScaler(si, t, pos, vec3(0, 0, 0));
+    return evaluateSegmentScaler(si, t, pos, moves[si.scalerMove - stream_firstMove].src);
+}
+
+template <typename F>
+F evaluateSegmentScaler(const segmentInfo_t<F>& si, F t, const vec3_t<F>& pos, const vec3_t<F>& scalerSrc)
+{
+    if (si.scalerIsPolynomial)
+        return si.scalerPoly[0] + t * (si.scalerPoly[1] + t * (si.scalerPoly[2] + t * si.scalerPoly[3]));
+
+    auto dist = pos - scalerSrc;
+    return si.scaler_start + (si.scaler * si.scalerInvLength) * dist.Length();
+}
+
+// Evaluates position, velocity and acceleration at n time offsets within the segment. Any of the outputs can be null.
+template <typename F>
+void planner_t<F>::getSegmentStateBatch(int segmentInd, const F* t, size_t n, vec3Array pos, vec3Array vel, vec3Array acc)
+{
+    evaluateCubicBatch(segments.getPos(segmentInd), segments.getVel(segmentInd), segments.getHalfAcc(segmentInd), segments.getSixthJerk(segmentInd), t, n, pos, vel, acc);
+}
+
+template <typename F>
+void getSegmentPosition(segment_t<F>& s, F t, vec3_t<F>* pos )
+{
+    *pos = s.pos + (t * s.vel) + ((t * t) / (F)2.0) * s.acc + ((t * t * t) / (F)6.0) * s.jerk;
+}
+
+template <typename F>
+void segmentTable_t<F>::getPosition(size_t i, F t, vec3* pos) const
+{
+    *pos = getPos(i) + t * (getVel(i) + t * (getHalfAcc(i) + t * getSixthJerk(i)));
+}
+
+// All the arrays that have one entry per segment
+template <typename F>
+segmentTable_t<F>::segmentTable_t(std::pmr::memory_resource* resource)
+    : posX(resource), posY(resource), posZ(resource),
+      velX(resource), velY(resource), velZ(resource),
+      halfAccX(resource), halfAccY(resource), halfAccZ(resource),
+      sixthJerkX(resource), sixthJerkY(resource), sixthJerkZ(resource),
+      duration(resource),
+      endPosX(resource), endPosY(resource), endPosZ(resource),
+      endVelX(resource), endVelY(resource), endVelZ(resource),
+      info(resource)
+{
+}
+
+#define SEGMENTTABLE_ARRAYS(t) { &(t).posX, &(t).posY, &(t).posZ, &(t).velX, &(t).velY, &(t).velZ, &(t).halfAccX, &(t).halfAccY, &(t).halfAccZ, \
+                                &(t).sixthJerkX, &(t).sixthJerkY, &(t).sixthJerkZ, &(t).duration, &(t).endPosX, &(t).endPosY, &(t).endPosZ, \
+                                &(t).endVelX, &(t).endVelY, &(t).endVelZ }
+
+template <typename F>
+void segmentTable_t<F>::clear()
+{
+    std::pmr::vector<F>* arrays[] = SEGMENTTABLE_ARRAYS(*this);
+    for (size_t k = 0; k < sizeof(arrays) / sizeof(arrays[0]); k++)
+        arrays[k]->clear();
+    info.clear();
+}
+
+template <typename F>
+void segmentTable_t<F>::release()
+{
+    std::pmr::vector<F>* arrays[] = SEGMENTTABLE_ARRAYS(*this);
+    for (size_t k = 0; k < sizeof(arrays) / sizeof(arrays[0]); k++)
+        std::pmr::vector<F>(arrays[k]->get_allocator()).swap(*arrays[k]);
+    std::pmr::vector<segmentInfo>(info.get_allocator()).swap(info);
+}
+
+template <typename F>
+void segmentTable_t<F>::reserve(size_t n)
+{
+    std::pmr::vector<F>* arrays[] = SEGMENTTABLE_ARRAYS(*this);
+    for (size_t k = 0; k < sizeof(arrays) / sizeof(arrays[0]); k++)
+        arrays[k]->reserve(n);
+    info.reserve(n);
+}
+
+template <typename F>
+void segmentTable_t<F>::resize(size_t n)
+{
+    std::pmr::vector<F>* arrays[] = SEGMENTTABLE_ARRAYS(*this);
+    for (size_t k = 0; k < sizeof(arrays) / sizeof(arrays[0]); k++)
+        arrays[k]->resize(n);
+    info.resize(n);
+}
+
+template <typename F>
+void segmentTable_t<F>::push_back(const segment& s, const segmentInfo& si)
 {
-    *pos = s.pos + (t * s.vel) + ((t * t) / (scv_float)2.0) * s.acc + ((t * t * t) / (scv_float)6.0) * s.jerk;
+    resize(size() + 1);
+    set(size() - 1, s, si);
 }
 
-bool planner::getTrajectoryState_constantJerkSegments(scv_float t, int* segmentIndex, vec3* pos, vec3* vel, vec3* acc, vec3* jerk, scv_float* scaler, scv_float tconst, int* mOwner, int* sconse)
+// Overwrites row i, which must already exist
+template <typename F>
+void segmentTable_t<F>::set(size_t i, const segment& s, const segmentInfo& si)
+{
+    vec3 c2 = (F)0.5 * s.acc;
+    vec3 c3 = ((F)1.0 / (F)6.0) * s.jerk;
+    F d = s.duration;
+    vec3 endPos = s.pos + d * (s.vel + d * (c2 + d * c3));
+    vec3 endVel = s.vel + d * ((F)2 * c2 + d * ((F)3 * c3));
+
+    posX[i] = s.pos.x;          posY[i] = s.pos.y;          posZ[i] = s.pos.z;
+    velX[i] = s.vel.x;          velY[i] = s.vel.y;          velZ[i] = s.vel.z;
+    halfAccX[i] = c2.x;         halfAccY[i] = c2.y;         halfAccZ[i] = c2.z;
+    sixthJerkX[i] = c3.x;       sixthJerkY[i] = c3.y;       sixthJerkZ[i] = c3.z;
+    duration[i] = d;
+    endPosX[i] = endPos.x;      endPosY[i] = endPos.y;      endPosZ[i] = endPos.z;
+    endVelX[i] = endVel.x;      endVelY[i] = endVel.y;      endVelZ[i] = endVel.z;
+    info[i] = si;
+}
+
+// Overwrites the entries that exist in both, then inserts or erases the difference
+template <typename T>
+static void replaceRange(std::pmr::vector<T>& v, size_t first, size_t count, const std::pmr::vector<T>& rows)
+{
+    size_t common = min(count, rows.size());
+    std::copy(rows.begin(), rows.begin() + common, v.begin() + first);
+    if ( rows.size() > count )
+        v.insert(v.begin() + first + common, rows.begin() + common, rows.end());
+    else if ( rows.size() < count )
+        v.erase(v.begin() + first + common, v.begin() + first + count);
+}
+
+template <typename F>
+void segmentTable_t<F>::replace(size_t first, size_t count, const segmentTable_t& rows)
+{
+    std::pmr::vector<F>* arrays[] = SEGMENTTABLE_ARRAYS(*this);
+    const std::pmr::vector<F>* rowArrays[] = SEGMENTTABLE_ARRAYS(rows);
+    for (size_t k = 0; k < sizeof(arrays) / sizeof(arrays[0]); k++)
+        replaceRange(*arrays[k], first, count, *rowArrays[k]);
+    replaceRange(info, first, count, rows.info);
+}
+
+// Returns the index of the segment containing time t, by binary search of the start times.
+// This will be -1 if t is before the start of the path, or segments.size() if t is beyond the end.
+template <typename F>
+int planner_t<F>::findSegmentIndex(double t)
+{
+    std::pmr::vector<double>::iterator it = std::upper_bound(segmentStartTimes.begin(), segmentStartTimes.end(), t);
+    return (int)(it - segmentStartTimes.begin()) - 1;
+}
+
+// Same as above, but starts looking from a previously found segment. The search gallops forward
+// from the hint, so queries that only move forward a little each time will only look at a few
+// entries. Times before the hinted segment fall back to a normal binary search.
+template <typename F>
+int planner_t<F>::findSegmentIndex(double t, int hint)
+{
+    if ( hint < 0 || hint >= (int)segments.size() || t < segmentStartTimes[hint] )
+        return findSegmentIndex(t);
+
+    size_t lo = hint;
+    size_t step = 1;
+    size_t hi = lo + step;
+    while ( hi < segmentStartTimes.size() && segmentStartTimes[hi] <= t ) {
+        lo = hi;
+        step *= 2;
+        hi = lo + step;
+    }
+    hi = min(hi, segmentStartTimes.size());
+
+    std::pmr::vector<double>::iterator it = std::upper_bound(segmentStartTimes.begin() + lo, segmentStartTimes.begin() + hi, t);
+    return (int)(it - segmentStartTimes.begin()) - 1;
+}
+
+template <typename F>
+bool planner_t<F>::getTrajectoryStateAtSegment(int segmentInd, double t, int* segmentIndex, vec3* pos, vec3* vel, vec3* acc, vec3* jerk, F* scaler, int* mOwner, int* sconse)
+{
+    if ( segmentInd < (int)segments.size() ) {
+        *segmentIndex = segmentInd;
+        getSegmentState(segmentInd, (F)(t - segmentStartTimes[segmentInd]), pos, vel, acc, jerk, scaler);
+        if (mOwner)
+        {
+            *mOwner = segments.info[segmentInd].moveOwner;
+            *sconse = segments.info[segmentInd].consecutiveNumber;
+        }
+        return true;
+    }
+
+    // time exceeds total time of trajectory, return end point
+    int lastSegment = (int)segments.size()-1;
+    *segmentIndex = lastSegment;
+    getSegmentEndState(lastSegment, pos, vel, acc, jerk, scaler);
+    return false;
+}
+
+template <typename F>
+bool planner_t<F>::getTrajectoryState_constantJerkSegments(F t, int* segmentIndex, vec3* pos, vec3* vel, vec3* acc, vec3* jerk, F* scaler, F tconst, int* mOwner, int* sconse)
 {
     // no segments, return zero vectors
     if ( segments.empty() ) {
         *segmentIndex = -1;
-        *pos = vec3_zero;
-        *vel = vec3_zero;
-        *acc = vec3_zero;
-        *jerk = vec3_zero;
+        *pos = vec3(0, 0, 0);
+        *vel = vec3(0, 0, 0);
+        *acc = vec3(0, 0, 0);
+        *jerk = vec3(0, 0, 0);
         return false;
     }
 
     // time is negative, return starting point
     if ( t <= 0 ) {
-        *pos = segments[0].pos;
-        *vel = segments[0].vel;
-        *acc = segments[0].acc;
-        *jerk = segments[0].jerk;
+        *pos = segments.getPos(0);
+        *vel = segments.getVel(0);
+        *acc = segments.getAcc(0);
+        *jerk = segments.getJerk(0);
         return t == 0;
     }
 
-    scv_float totalT = 0;
-    size_t segmentInd = 0;
-    while (segmentInd < segments.size()) {
-        *segmentIndex = (int)segmentInd;
-        segment& s = segments[segmentInd];
-        scv_float endT = totalT + s.duration;
-        if ( t >= totalT && t < endT ) {
-            getSegmentState(s, t - totalT, pos, vel, acc, jerk, scaler);
-            if (mOwner)
-            {
-                *mOwner = segments[segmentInd].moveOwner;
-                *sconse = segments[segmentInd].consecutiveNumber;
-            }
-            /*if (s.duration > tconst)
-                *scaler = *scaler * tconst / s.duration;
-            else
-                printf("goddam");*/
-            return true;
-        }
-        segmentInd++;
-        totalT = endT;
-    }
+    int segmentInd = findSegmentIndex(t);
+    return getTrajectoryStateAtSegment(segmentInd, t, segmentIndex, pos, vel, acc, jerk, scaler, mOwner, sconse);
+}
 
-    // time exceeds total time of trajectory, return end point
-    scv::segment& lastSegment = segments[segments.size()-1];
-    getSegmentState(lastSegment, lastSegment.duration, pos, vel, acc, jerk, scaler);
-    return false;
+// Same as getTrajectoryState_constantJerkSegments, but the lookup starts from the segment found
+// by the previous call. Use this when the queries are (mostly) in increasing order of time.
+template <typename F>
+bool planner_t<F>::getTrajectoryStateHinted_constantJerkSegments(F t, int* segmentIndex, vec3* pos, vec3* vel, vec3* acc, vec3* jerk, F* scaler, int* mOwner, int* sconse)
+{
+    if ( segments.empty() || t <= 0 )
+        return getTrajectoryState_constantJerkSegments(t, segmentIndex, pos, vel, acc, jerk, scaler, 0, mOwner, sconse);
+
+    int segmentInd = findSegmentIndex(t, lookup_segmentIndex);
+    lookup_segmentIndex = segmentInd;
+    return getTrajectoryStateAtSegment(segmentInd, t, segmentIndex, pos, vel, acc, jerk, scaler, mOwner, sconse);
 }
 
-void getMoveSegmentState(segment& s, scv_float t, vec3* pos, vec3* vel, vec3* acc, vec3* jerk )
+template <typename F>
+void getMoveSegmentState(segment_t<F>& s, F t, vec3_t<F>* pos, vec3_t<F>* vel, vec3_t<F>* acc, vec3_t<F>* jerk )
 {
-    *pos = s.pos + (t * s.vel) + ((t * t) / (scv_float)2.0) * s.acc + ((t * t * t) / (scv_float)6.0) * s.jerk;
-    *vel = s.vel + (t * s.acc) + ((t * t) / (scv_float)2.0) * s.jerk;
+    *pos = s.pos + (t * s.vel) + ((t * t) / (F)2.0) * s.acc + ((t * t * t) / (F)6.0) * s.jerk;
+    *vel = s.vel + (t * s.acc) + ((t * t) / (F)2.0) * s.jerk;
     *acc = s.acc + t * s.jerk;
     *jerk = s.jerk;
 }
 
-bool getMoveTrajectoryState(move &m, scv_float t, int *segmentIndex, vec3 *pos, vec3 *vel, vec3 *acc, vec3 *jerk)
+template <typename F>
+bool getMoveTrajectoryState(move_t<F> &m, F t, int *segmentIndex, vec3_t<F> *pos, vec3_t<F> *vel, vec3_t<F> *acc, vec3_t<F> *jerk)
 {
     // no segments, return zero vectors
     if ( m.segments.empty() ) {
         *segmentIndex = -1;
-        *pos = vec3_zero;
-        *vel = vec3_zero;
-        *acc = vec3_zero;
-        *jerk = vec3_zero;
+        *pos = vec3_t<F>(0, 0, 0);
+        *vel = vec3_t<F>(0, 0, 0);
+        *acc = vec3_t<F>(0, 0, 0);
+        *jerk = vec3_t<F>(0, 0, 0);
         return false;
     }
 
@@ -530,12 +2089,12 @@ bool getMoveTrajectoryState(move &m, scv_float t, int *segmentIndex, vec3 *pos,
         return t == 0;
     }
 
-    scv_float totalT = 0;
+    F totalT = 0;
     size_t segmentInd = 0;
     while (segmentInd < m.segments.size()) {
         *segmentIndex = (int)segmentInd;
-        segment& s = m.segments[segmentInd];
-        scv_float endT = totalT + s.duration;
+        segment_t<F>& s = m.segments[segmentInd];
+        F endT = totalT + s.duration;
         if ( t >= totalT && t < endT ) {
             getMoveSegmentState(s, t - totalT, pos, vel, acc, jerk);
             return true;
@@ -545,76 +2104,419 @@ bool getMoveTrajectoryState(move &m, scv_float t, int *segmentIndex, vec3 *pos,
     }
 
     // time exceeds total time of trajectory, return end point
-    scv::segment& lastSegment = m.segments.back();
+    segment_t<F>& lastSegment = m.segments.back();
     getMoveSegmentState(lastSegment, lastSegment.duration, pos, vel, acc, jerk);
     return false;
 }
 
-bool planner::getTrajectoryState_interpolatedMoves(scv_float time, int *segmentIndex, vec3 *pos, vec3 *vel, vec3 *acc, vec3 *jerk)
+template <typename F>
+bool planner_t<F>::getTrajectoryState_interpolatedMoves(F time, int *segmentIndex, vec3 *pos, vec3 *vel, vec3 *acc, vec3 *jerk)
+{
+    bool stillRunning = false;
+    *pos = vec3(0, 0, 0);
+    *vel = vec3(0, 0, 0);
+    *acc = vec3(0, 0, 0);
+    *jerk = vec3(0, 0, 0);
+
+    vec3 lastSrc = vec3(0, 0, 0);
+    int movesUsed = 0;
+
+    findActiveMoves(time);
+
+    for (size_t i = 0; i < activeMoves.size(); i++) {
+        move& m = moves[activeMoves[i]];
+
+        lastSrc = m.src;
+        movesUsed++;
+
+        F dt = time - m.scheduledTime;
+        int tmpSegmentIndex;
+        vec3 p, v, a, j;
+        stillRunning |= getMoveTrajectoryState(m, dt, &tmpSegmentIndex, &p, &v, &a, &j);
+        *pos += p;
+        *vel += v;
+        *acc += a;
+        *jerk += j;
+    }
+
+    if ( movesUsed > 1 ) {
+        *pos -= lastSrc;
+        *segmentIndex = 0;
+    }
+    else
+        *segmentIndex = 1;
+
+    return stillRunning;
+}
+
+// Maximum number of samples from the same segment evaluated together by sampleSegmentRun
+#define SAMPLEBATCH 64
+
+template <typename F>
+size_t sampleSegmentRun(const segmentTable_t<F>& segments, size_t row, double segmentStart, double segmentEnd, bool isLast, const vec3_t<F>& scalerSrc, int segmentIndex,
+                        double t0, double dt, size_t first, size_t maxRun, sampleBuffers_t<F>& out, size_t count)
+{
+    typedef vec3_t<F> vec3;
+    typedef vec3Array_t<F> vec3Array;
+    const segmentInfo_t<F>& si = segments.info[row];
+
+    F localTimes[SAMPLEBATCH];
+    F scratchX[SAMPLEBATCH], scratchY[SAMPLEBATCH], scratchZ[SAMPLEBATCH];
+
+    // gather the run of samples that fall in this segment
+    maxRun = min(maxRun, (size_t)SAMPLEBATCH);
+    size_t n = 0;
+    while ( n < maxRun ) {
+        double st = t0 + (first + n) * dt;
+        if ( ! isLast && st >= segmentEnd )
+            break;
+        localTimes[n] = (F)min(max(st - segmentStart, 0.0), (double)segments.duration[row]);
+        if ( out.time )
+            out.time[count + n] = st;
+        n++;
+    }
+    if ( n == 0 )
+        return 0;
+
+    // a scaler that is not a polynomial needs positions, even if the caller doesn't want them
+    bool needScaler = out.scaler && ! si.scalerIsPolynomial;
+    vec3Array pos = out.pos.offset(count);
+    if ( pos.isNull() && needScaler )
+        pos = vec3Array(scratchX, scratchY, scratchZ);
+    evaluateCubicBatch(segments.getPos(row), segments.getVel(row), segments.getHalfAcc(row), segments.getSixthJerk(row), localTimes, n, pos, out.vel.offset(count), out.acc.offset(count));
+
+    for (size_t i = 0; i < n; i++) {
+        size_t c = count + i;
+        if ( ! out.jerk.isNull() )      out.jerk.set(c, segments.getJerk(row));
+        if ( out.scaler )               out.scaler[c] = evaluateSegmentScaler(si, localTimes[i], needScaler ? pos.get(i) : vec3(0, 0, 0), scalerSrc);
+        if ( out.segmentIndex )         out.segmentIndex[c] = segmentIndex;
+        if ( out.moveOwner )            out.moveOwner[c] = si.moveOwner;
+        if ( out.consecutiveNumber )    out.consecutiveNumber[c] = si.consecutiveNumber;
+    }
+    return n;
+}
+
+// Fills the buffers with the trajectory state at regular intervals of dt, from t0 up to and including t1.
+// The segments are walked forward once instead of being looked up for every sample, so the cost is
+// linear in the number of samples. When the buffers are full the callback is given the completed chunk,
+// and the buffers are then reused from the start. Without a callback, sampling stops when the buffers
+// are full. Returns the total number of samples taken.
+template <typename F>
+size_t planner_t<F>::sampleUniform(double dt, double t0, double t1, sampleBuffers& out, sampleCallback callback, void* userData)
+{
+    if ( dt <= 0 || t1 < t0 || out.capacity == 0 )
+        return 0;
+
+    size_t numSamples = (size_t)((t1 - t0) / dt + 0.000001) + 1;
+    if ( ! callback )
+        numSamples = min(numSamples, out.capacity);
+
+    int numSegments = (int)segments.size();
+    int segmentInd = max(0, findSegmentIndex(t0));
+
+    size_t count = 0;
+    size_t k = 0;
+    while ( k < numSamples ) {
+        double t = t0 + k * dt;
+
+        if ( blendMethod != CBM_INTERPOLATED_MOVES && numSegments > 0 ) {
+            // move forward to the segment containing t, or stay on the last one if t is beyond the end
+            while ( segmentInd < numSegments-1 && t >= segmentStartTimes[segmentInd+1] )
+                segmentInd++;
+            const segmentInfo& si = segments.info[segmentInd];
+            bool isLastSegment = segmentInd == numSegments-1;
+            double segmentEnd = isLastSegment ? t1 : segmentStartTimes[segmentInd+1];
+            vec3 scalerSrc = si.scalerIsPolynomial ? vec3(0, 0, 0) : moves[si.scalerMove - stream_firstMove].src;
+            size_t n = sampleSegmentRun(segments, segmentInd, segmentStartTimes[segmentInd], segmentEnd, isLastSegment, scalerSrc, segmentInd,
+                                        t0, dt, k, min(numSamples - k, out.capacity - count), out, count);
+            count += n;
+            k += n;
+        }
+        else {
+            vec3 p, v, a, j;
+            int segIndex = -1;
+
+            if ( blendMethod == CBM_INTERPOLATED_MOVES )
+                getTrajectoryState_interpolatedMoves((F)t, &segIndex, &p, &v, &a, &j);
+            else
+                p = v = a = j = vec3(0, 0, 0);
+
+            if ( out.time )                 out.time[count] = t;
+            if ( ! out.pos.isNull() )       out.pos.set(count, p);
+            if ( ! out.vel.isNull() )       out.vel.set(count, v);
+            if ( ! out.acc.isNull() )       out.acc.set(count, a);
+            if ( ! out.jerk.isNull() )      out.jerk.set(count, j);
+            if ( out.scaler )               out.scaler[count] = 0;
+            if ( out.segmentIndex )         out.segmentIndex[count] = segIndex;
+            if ( out.moveOwner )            out.moveOwner[count] = -1;
+            if ( out.consecutiveNumber )    out.consecutiveNumber[count] = -1;
+            count++;
+            k++;
+        }
+
+        if ( count == out.capacity && callback ) {
+            callback(out, count, userData);
+            count = 0;
+        }
+    }
+
+    if ( count > 0 && callback )
+        callback(out, count, userData);
+
+    return numSamples;
+}
+
+template <typename F>
+F planner_t<F>::getTraverseTime_constantJerkSegments()
+{
+    if ( segmentStartTimes.empty() )
+        return 0;
+    return (F)segmentStartTimes.back();
+}
+
+// Speed along a segment, |c1 + 2*c2*t + 3*c3*t^2| where c2 and c3 are the half acceleration and
+// sixth jerk coefficients from the segment table. Evaluated in double since it gets integrated.
+struct segmentSpeed {
+    double c1[3], c2[3], c3[3];
+
+    double operator()(double t) const {
+        double sq = 0;
+        for (int k = 0; k < 3; k++) {
+            double v = c1[k] + t * (2 * c2[k] + t * (3 * c3[k]));
+            sq += v * v;
+        }
+        return sqrt(sq);
+    }
+};
+
+template <typename F>
+static segmentSpeed getSegmentSpeed(const segmentTable_t<F>& segments, int i)
+{
+    segmentSpeed f;
+    f.c1[0] = segments.velX[i];        f.c1[1] = segments.velY[i];        f.c1[2] = segments.velZ[i];
+    f.c2[0] = segments.halfAccX[i];    f.c2[1] = segments.halfAccY[i];    f.c2[2] = segments.halfAccZ[i];
+    f.c3[0] = segments.sixthJerkX[i];  f.c3[1] = segments.sixthJerkY[i];  f.c3[2] = segments.sixthJerkZ[i];
+    return f;
+}
+
+// Five point Gauss-Legendre quadrature of the speed over [a,b]
+static double integrateSpeedGL5(const segmentSpeed& f, double a, double b)
+{
+    static const double x[3] = { 0.0, 0.5384693101056831, 0.9061798459386640 };
+    static const double w[3] = { 0.5688888888888889, 0.4786286704993665, 0.2369268850561891 };
+
+    double h = 0.5 * (b - a);
+    double m = 0.5 * (a + b);
+    double sum = w[0] * f(m);
+    for (int i = 1; i < 3; i++)
+        sum += w[i] * (f(m - h * x[i]) + f(m + h * x[i]));
+    return h * sum;
+}
+
+// Adaptive refinement, splitting the interval where the halves don't agree with the whole
+static double integrateSpeed(const segmentSpeed& f, double a, double b, double whole, double tolerance, int depth)
+{
+    double m = 0.5 * (a + b);
+    double left = integrateSpeedGL5(f, a, m);
+    double right = integrateSpeedGL5(f, m, b);
+    if ( depth <= 0 || fabs(left + right - whole) <= tolerance )
+        return left + right;
+    return integrateSpeed(f, a, m, left, 0.5 * tolerance, depth - 1) +
+           integrateSpeed(f, m, b, right, 0.5 * tolerance, depth - 1);
+}
+
+// Finds the times in (0,d) where the speed has a local minimum, ie. where v.a changes from negative
+// to positive. The speed can have a sharp corner there (eg. a blend that doubles back comes to a stop
+// and reverses) which quadrature handles badly, so the integration is split at these. v.a is a cubic,
+// so the roots are found between its turning points where it is monotonic. Returns the number of
+// times written to 'breaks', in increasing order.
+static int getSpeedBreaks(const segmentSpeed& f, double d, double* breaks)
 {
-    bool stillRunning = false;
-    *pos = vec3_zero;
-    *vel = vec3_zero;
-    *acc = vec3_zero;
-    *jerk = vec3_zero;
-
-    vec3 lastSrc = vec3_zero;
-    int movesUsed = 0;
+    // v.a = g0 + g1*t + g2*t^2 + g3*t^3
+    double g0 = 0, g1 = 0, g2 = 0, g3 = 0;
+    for (int k = 0; k < 3; k++) {
+        g0 += 2 * f.c1[k] * f.c2[k];
+        g1 += 6 * f.c1[k] * f.c3[k] + 4 * f.c2[k] * f.c2[k];
+        g2 += 18 * f.c2[k] * f.c3[k];
+        g3 += 18 * f.c3[k] * f.c3[k];
+    }
 
-    for (size_t i = 0; i < moves.size(); i++) {
-        move& m = moves[i];
-        float mEnd = m.scheduledTime + m.duration;
-        if ( time < m.scheduledTime || time > mEnd )
+    double ends[4];
+    int numEnds = 0;
+    ends[numEnds++] = 0;
+    double a = 3 * g3, b = 2 * g2, c = g1;
+    double r[2];
+    int numRoots = 0;
+    if ( a != 0 ) {
+        double disc = b * b - 4 * a * c;
+        if ( disc > 0 ) {
+            double q = -0.5 * (b + (b < 0 ? -1 : 1) * sqrt(disc));
+            r[numRoots++] = q / a;
+            if ( q != 0 )
+                r[numRoots++] = c / q;
+        }
+    }
+    else if ( b != 0 )
+        r[numRoots++] = -c / b;
+    if ( numRoots == 2 && r[1] < r[0] )
+        std::swap(r[0], r[1]);
+    for (int i = 0; i < numRoots; i++)
+        if ( r[i] > 0 && r[i] < d )
+            ends[numEnds++] = r[i];
+    ends[numEnds++] = d;
+
+    int numBreaks = 0;
+    for (int i = 0; i < numEnds - 1; i++) {
+        double lo = ends[i];
+        double hi = ends[i+1];
+        if ( g0 + lo * (g1 + lo * (g2 + lo * g3)) >= 0 || g0 + hi * (g1 + hi * (g2 + hi * g3)) <= 0 )
             continue;
 
-        lastSrc = m.src;
-        movesUsed++;
-
-        scv_float dt = time - m.scheduledTime;
-        int tmpSegmentIndex;
-        vec3 p, v, a, j;
-        stillRunning |= getMoveTrajectoryState(m, dt, &tmpSegmentIndex, &p, &v, &a, &j);
-        *pos += p;
-        *vel += v;
-        *acc += a;
-        *jerk += j;
+        // Newton's method, kept inside the bracket by bisection
+        double t = 0.5 * (lo + hi);
+        for (int k = 0; k < 60 && hi - lo > 1e-12 * d; k++) {
+            double g = g0 + t * (g1 + t * (g2 + t * g3));
+            if ( g < 0 )
+                lo = t;
+            else if ( g > 0 )
+                hi = t;
+            else
+                break;
+            double dg = g1 + t * (2 * g2 + t * 3 * g3);
+            double next = dg > 0 ? t - g / dg : lo;
+            if ( next <= lo || next >= hi )
+                next = 0.5 * (lo + hi);
+            if ( next == t )
+                break;
+            t = next;
+        }
+        breaks[numBreaks++] = t;
     }
+    return numBreaks;
+}
 
-    if ( movesUsed > 1 ) {
-        *pos -= lastSrc;
-        *segmentIndex = 0;
-    }
-    else
-        *segmentIndex = 1;
+// Distance travelled from the start of a segment to time t within it
+template <typename F>
+double planner_t<F>::getSegmentArcLength(int segmentInd, double t)
+{
+    if ( t <= 0 )
+        return 0;
 
-    return stillRunning;
+    segmentSpeed f = getSegmentSpeed(segments, segmentInd);
+    double breaks[3];
+    int numBreaks = getSpeedBreaks(f, segments.duration[segmentInd], breaks);
+
+    double s = 0;
+    double a = 0;
+    for (int i = 0; i <= numBreaks && a < t; i++) {
+        double b = i < numBreaks ? min(breaks[i], t) : t;
+        double whole = integrateSpeedGL5(f, a, b);
+        s += integrateSpeed(f, a, b, whole, 1e-9 * whole, 10);
+        a = b;
+    }
+    return s;
 }
 
-scv_float planner::getTraverseTime_constantJerkSegments()
+// Time within a segment at which the distance travelled from its start reaches s. Newton's method,
+// falling back to bisection when a step would leave the bracketing interval.
+template <typename F>
+double planner_t<F>::getSegmentTimeAtArcLength(int segmentInd, double s)
 {
-    scv_float t = 0;
-    size_t segmentInd = 0;
-    while (segmentInd < segments.size()) {
-        segment& s = segments[segmentInd];
-        t += s.duration;
-        segmentInd++;
+    double d = segments.duration[segmentInd];
+    double length = segmentStartDistances[segmentInd+1] - segmentStartDistances[segmentInd];
+    if ( s <= 0 || length <= 0 )
+        return 0;
+    if ( s >= length )
+        return d;
+
+    segmentSpeed f = getSegmentSpeed(segments, segmentInd);
+    double lo = 0;
+    double hi = d;
+    double t = d * (s / length);
+    for (int i = 0; i < 50; i++) {
+        double err = getSegmentArcLength(segmentInd, t) - s;
+        if ( fabs(err) <= 1e-12 * length )
+            break;
+        if ( err > 0 )
+            hi = t;
+        else
+            lo = t;
+
+        double speed = f(t);
+        double next = speed > 0 ? t - err / speed : lo - 1;
+        if ( next <= lo || next >= hi )
+            next = 0.5 * (lo + hi);
+        if ( next == t )
+            break;
+        t = next;
     }
     return t;
 }
 
-scv_float planner::getTraverseTime_interpolatedMoves()
+// Integrates the length of each segment once, for the distance queries below
+template <typename F>
+void planner_t<F>::buildDistanceTable()
 {
-    scv_float t = 0;
-    for (size_t i = 0; i < moves.size(); i++) {
-        move& m = moves[i];
-        scv_float endTime = m.scheduledTime + m.duration;
-        if ( endTime > t )
-            t = endTime;
+    if ( segmentStartDistances.size() == segments.size() + 1 )
+        return;
+
+    segmentStartDistances.resize(segments.size() + 1);
+    double totalS = 0;
+    for (size_t i = 0; i < segments.size(); i++) {
+        segmentStartDistances[i] = totalS;
+        totalS += getSegmentArcLength((int)i, segments.duration[i]);
     }
-    return t;
+    segmentStartDistances[segments.size()] = totalS;
+}
+
+template <typename F>
+double planner_t<F>::getTraverseDistance()
+{
+    buildDistanceTable();
+    return segmentStartDistances.back();
+}
+
+// Distance along the path travelled by time t. Times outside the path are clamped to its ends.
+template <typename F>
+double planner_t<F>::getDistanceAtTime(double t)
+{
+    buildDistanceTable();
+    if ( segments.empty() || t <= 0 )
+        return 0;
+
+    int segmentInd = findSegmentIndex(t);
+    if ( segmentInd >= (int)segments.size() )
+        return segmentStartDistances.back();
+
+    return segmentStartDistances[segmentInd] + getSegmentArcLength(segmentInd, t - segmentStartTimes[segmentInd]);
+}
+
+// Time at which the distance travelled along the path reaches s. Distances outside the path
+// are clamped to its ends. Where the path stands still the earliest time is not guaranteed,
+// only one at which the distance is s.
+template <typename F>
+double planner_t<F>::getTimeAtDistance(double s)
+{
+    buildDistanceTable();
+    if ( segments.empty() || s <= 0 )
+        return 0;
+    if ( s >= segmentStartDistances.back() )
+        return segmentStartTimes.back();
+
+    std::pmr::vector<double>::iterator it = std::upper_bound(segmentStartDistances.begin(), segmentStartDistances.end(), s);
+    int segmentInd = (int)(it - segmentStartDistances.begin()) - 1;
+
+    return segmentStartTimes[segmentInd] + getSegmentTimeAtArcLength(segmentInd, s - segmentStartDistances[segmentInd]);
+}
+
+template <typename F>
+F planner_t<F>::getTraverseTime_interpolatedMoves()
+{
+    return interpolatedEndTime;
 }
 
-float planner::getTraverseTime()
+template <typename F>
+F planner_t<F>::getTraverseTime()
 {
     if ( blendMethod == CBM_INTERPOLATED_MOVES )
         return getTraverseTime_interpolatedMoves();
@@ -622,13 +2524,15 @@ float planner::getTraverseTime()
         return getTraverseTime_constantJerkSegments();
 }
 
-void planner::resetTraverse()
+template <typename F>
+void planner_t<F>::resetTraverse()
 {
     traversal_segmentIndex = 0;
     traversal_segmentTime = 0;
 
     traversal_time = 0;
-    traversal_pos = vec3_zero;
+    traversal_pos = vec3(0, 0, 0);
+    traversal_firstMove = 0;
     for (size_t i = 0; i < moves.size(); i++) {
         move& m = moves[i];
         m.traversal_segmentIndex = 0;
@@ -636,10 +2540,11 @@ void planner::resetTraverse()
     }
 }
 
-bool planner::advanceTraverse_constantJerkSegments(scv_float dt, vec3 *p)
+template <typename F>
+bool planner_t<F>::advanceTraverse_constantJerkSegments(F dt, vec3 *p)
 {
     if ( segments.empty() ) {
-        *p = vec3_zero;
+        *p = vec3(0, 0, 0);
         return false;
     }
 
@@ -647,41 +2552,163 @@ bool planner::advanceTraverse_constantJerkSegments(scv_float dt, vec3 *p)
         return false;
 
     traversal_segmentTime += dt;
-    segment seg = segments[traversal_segmentIndex];
 
     // Use 'while' here to consume zero-duration (or otherwise very short) segments immediately!
     // It's pretty important to make sure that dt is actually within the next segment instead of
     // just assuming it is, otherwise we might return a location beyond the end of the next
     // segment, and then in the following iteration a location near the start of the following
     // segment, which could potentially reverse the direction of travel!
-    while ( traversal_segmentTime > seg.duration ) {
+    while ( traversal_segmentTime > segments.duration[traversal_segmentIndex] ) {
         // exceeded current segment
         if ( traversal_segmentIndex < ((int)segments.size()-1) ) {
             // more segments remain
+            traversal_segmentTime -= segments.duration[traversal_segmentIndex];
             traversal_segmentIndex++;
-            traversal_segmentTime -= seg.duration;
-            seg = segments[traversal_segmentIndex];
         }
         else {
             // already on final segment
-            getSegmentPosition(seg, seg.duration, p);
+            *p = segments.getEndPos(traversal_segmentIndex);
             return false;
         }
     }
 
-    getSegmentPosition(seg, traversal_segmentTime, p);
+    segments.getPosition(traversal_segmentIndex, traversal_segmentTime, p);
+    return true;
+}
+
+// Start a traversal that advances by the same time step every call. This only applies to
+// constant jerk segments, it does not cover the interpolated moves method. With 'exact' each
+// step evaluates the segment cubic instead of using forward differences, which costs a little
+// more but makes the position depend only on the tick number.
+template <typename F>
+void planner_t<F>::resetTraverse_fixedStep(double dt, bool exact)
+{
+    fixedStep_dt = dt;
+    fixedStep_exact = exact;
+    fixedStep_tick = 0;
+    fixedStep_segmentEndTick = 0; // look up the segment on the next step
+    fixedStep_startTicks.clear(); // the ticks depend on dt
+}
+
+// Converts the segment start times to ticks. Tick k is at time k*dt, and belongs to segment i if
+// segmentStartTimes[i] <= k*dt < segmentStartTimes[i+1], the same as findSegmentIndex. Segments too
+// short to contain a tick get the same first tick as the segment after them, and are never used.
+template <typename F>
+void planner_t<F>::buildTickTable()
+{
+    double h = fixedStep_dt;
+    fixedStep_startTicks.resize(segmentStartTimes.size());
+    fixedStep_phase.resize(segmentStartTimes.size());
+    for (size_t i = 0; i < segmentStartTimes.size(); i++) {
+        double t = segmentStartTimes[i];
+        long long k = (long long)ceil(t / h);
+        while ( k * h < t )
+            k++;
+        while ( k > 0 && (k-1) * h >= t )
+            k--;
+        fixedStep_startTicks[i] = k;
+        fixedStep_phase[i] = k * h - t;
+    }
+    fixedStep_segmentIndex = -1;
+}
+
+// Each segment is a cubic, so with a constant time step the position can be stepped with forward
+// differences, which is only three additions per axis. Where each segment starts is taken from the
+// tick table rather than found by adding up steps, and the differences are seeded again from the
+// exact segment values there, so long jobs don't drift. In exact mode the time within the segment is
+// instead worked out from the tick count on every step, so nothing is accumulated at all and a tick
+// gives exactly the same position no matter how it was reached.
+template <typename F>
+bool planner_t<F>::advanceTraverse_fixedStep(vec3 *p)
+{
+    if ( fixedStep_tick + 1 >= fixedStep_segmentEndTick )
+        return seedTraverse_fixedStep(p);
+
+    fixedStep_tick++;
+
+    if ( fixedStep_exact ) {
+        int i = fixedStep_segmentIndex;
+        double u = fixedStep_phase[i] + (double)(fixedStep_tick - fixedStep_startTicks[i]) * fixedStep_dt;
+        for (int k = 0; k < 3; k++)
+            fixedStep_diff[0][k] = fixedStep_coef[0][k] + u * (fixedStep_coef[1][k] + u * (fixedStep_coef[2][k] + u * fixedStep_coef[3][k]));
+    }
+    else {
+        for (int k = 0; k < 3; k++) {
+            fixedStep_diff[0][k] += fixedStep_diff[1][k];
+            fixedStep_diff[1][k] += fixedStep_diff[2][k];
+            fixedStep_diff[2][k] += fixedStep_diff[3][k];
+        }
+    }
+
+    p->Set( (F)fixedStep_diff[0][0], (F)fixedStep_diff[0][1], (F)fixedStep_diff[0][2] );
+    return true;
+}
+
+// Takes the next step when it is the first one in a segment, or when the segment isn't known yet.
+// The time within the segment comes from the tick table, so the forward differences start from the
+// exact value at every segment and rounding can only build up over the ticks of one segment.
+template <typename F>
+bool planner_t<F>::seedTraverse_fixedStep(vec3 *p)
+{
+    if ( segments.empty() || fixedStep_dt <= 0 ) {
+        *p = vec3(0, 0, 0);
+        return false;
+    }
+
+    if ( fixedStep_startTicks.empty() )
+        buildTickTable();
+
+    fixedStep_tick++;
+
+    int numSegments = (int)segments.size();
+    if ( fixedStep_tick >= fixedStep_startTicks[numSegments] ) {
+        // beyond the end of the final segment
+        *p = segments.getEndPos(numSegments-1);
+        return false;
+    }
+
+    int i = fixedStep_segmentIndex;
+    if ( i < 0 )
+        i = (int)(std::upper_bound(fixedStep_startTicks.begin(), fixedStep_startTicks.end(), fixedStep_tick) - fixedStep_startTicks.begin()) - 1;
+    while ( fixedStep_tick >= fixedStep_startTicks[i+1] )
+        i++;
+    fixedStep_segmentIndex = i;
+    fixedStep_segmentEndTick = fixedStep_startTicks[i+1];
+
+    double h = fixedStep_dt;
+    double u = fixedStep_phase[i] + (double)(fixedStep_tick - fixedStep_startTicks[i]) * h;
+    vec3 c[4] = { segments.getPos(i), segments.getVel(i), segments.getHalfAcc(i), segments.getSixthJerk(i) };
+    for (int k = 0; k < 3; k++) {
+        double c0 = c[0][k];
+        double c1 = c[1][k];
+        double c2 = c[2][k];
+        double c3 = c[3][k];
+        if ( fixedStep_exact ) {
+            fixedStep_coef[0][k] = c0;
+            fixedStep_coef[1][k] = c1;
+            fixedStep_coef[2][k] = c2;
+            fixedStep_coef[3][k] = c3;
+        }
+        fixedStep_diff[0][k] = c0 + u * (c1 + u * (c2 + u * c3));
+        fixedStep_diff[1][k] = c1 * h + c2 * (2*u*h + h*h) + c3 * (3*u*u*h + 3*u*h*h + h*h*h);
+        fixedStep_diff[2][k] = 2 * c2 * h*h + c3 * (6*u*h*h + 6*h*h*h);
+        fixedStep_diff[3][k] = 6 * c3 * h*h*h;
+    }
+
+    p->Set( (F)fixedStep_diff[0][0], (F)fixedStep_diff[0][1], (F)fixedStep_diff[0][2] );
     return true;
 }
 
-bool advanceMoveTraverse(move &m, scv_float dt, vec3 *p)
+template <typename F>
+bool advanceMoveTraverse(move_t<F> &m, F dt, vec3_t<F> *p)
 {
     if ( m.segments.empty() ) {
-        *p = vec3_zero;
+        *p = vec3_t<F>(0, 0, 0);
         return false;
     }
 
     m.traversal_segmentTime += dt;
-    segment seg = m.segments[m.traversal_segmentIndex];
+    segment_t<F> seg = m.segments[m.traversal_segmentIndex];
 
     // Use 'while' here to consume zero-duration (or otherwise very short) segments immediately!
     // It's pretty important to make sure that dt is actually within the next segment instead of
@@ -707,18 +2734,32 @@ bool advanceMoveTraverse(move &m, scv_float dt, vec3 *p)
     return true;
 }
 
-bool planner::advanceTraverse_interpolatedMoves(scv_float dt, vec3 *pos)
+template <typename F>
+bool planner_t<F>::advanceTraverse_interpolatedMoves(F dt, vec3 *pos)
 {
     bool stillRunning = false;
-    *pos = vec3_zero;
+    *pos = vec3(0, 0, 0);
 
-    vec3 lastSrc = vec3_zero;
+    vec3 lastSrc = vec3(0, 0, 0);
     int movesUsed = 0;
     bool movesRemain = false;
 
     traversal_time += dt;
 
-    for (size_t i = 0; i < moves.size(); i++) {
+    // Moves that have finished stay finished as long as time only goes forward, so they don't
+    // need to be looked at again. This keeps the loop below to just the moves around the current
+    // time, instead of everything since the start of the job.
+    if ( dt < 0 || traversal_firstMove > (int)moves.size() )
+        traversal_firstMove = 0;
+    while ( traversal_firstMove < (int)moves.size() ) {
+        move& m = moves[traversal_firstMove];
+        if ( traversal_time >= m.scheduledTime && traversal_time > m.scheduledTime + m.duration )
+            traversal_firstMove++;
+        else
+            break;
+    }
+
+    for (size_t i = traversal_firstMove; i < moves.size(); i++) {
         move& m = moves[i];
         if ( traversal_time < m.scheduledTime ) {
             movesRemain = true;
@@ -750,7 +2791,8 @@ bool planner::advanceTraverse_interpolatedMoves(scv_float dt, vec3 *pos)
     return stillRunning;
 }
 
-bool planner::advanceTraverse(scv_float dt, vec3 *pos)
+template <typename F>
+bool planner_t<F>::advanceTraverse(F dt, vec3 *pos)
 {
     if ( blendMethod == CBM_INTERPOLATED_MOVES )
         return advanceTraverse_interpolatedMoves(dt, pos);
@@ -758,26 +2800,29 @@ bool planner::advanceTraverse(scv_float dt, vec3 *pos)
         return advanceTraverse_constantJerkSegments(dt, pos);
 }
 
-scv::vec3 getClosestPointOnInfiniteLine(scv::vec3 line_start, scv::vec3 line_dir, scv::vec3 point, scv_float* d)
+template <typename F>
+vec3_t<F> getClosestPointOnInfiniteLine(vec3_t<F> line_start, vec3_t<F> line_dir, vec3_t<F> point, F* d)
 {
     *d = scv::dot( point - line_start, line_dir);
     return line_start + *d * line_dir;
 }
 
 // This assumes the jerk and acceleration are in the same direction
-scv_float calculateDurationFromJerkAndAcceleration(scv::vec3 j, scv::vec3 a)
+template <typename F>
+F calculateDurationFromJerkAndAcceleration(vec3_t<F> j, vec3_t<F> a)
 {
     if ( j.x != 0 )
-        return (scv_float)sqrt( a.x / j.x );
+        return (F)sqrt( a.x / j.x );
     else if ( j.y != 0 )
-        return (scv_float)sqrt( a.y / j.y );
+        return (F)sqrt( a.y / j.y );
     else if ( j.z != 0 )
-        return (scv_float)sqrt( a.z / j.z );
+        return (F)sqrt( a.z / j.z );
     // jerk is zero, so duration would be infinite!
     return 0;
 }
 
-void markSkippedSegments(move& l, int whichEnd)
+template <typename F>
+void markSkippedSegments(move_t<F>& l, int whichEnd)
 {
     int numSegments = (int)l.segments.size();
     if ( whichEnd == 0 ) { // remove the latter end
@@ -804,82 +2849,92 @@ void markSkippedSegments(move& l, int whichEnd)
     }
 }
 
-void planner::blendCorner(move& m0, move& m1, bool isFirst, bool isLast)
+// Works out the blend for the corner between m0 and m1, without changing either move. This only
+// reads the parts of the moves that the corners on either side of this one leave alone (the velocity
+// of the linear sections, and the positions that a blend can't move), so every corner in the path can
+// be planned at the same time. The one exception is the clearance for the first corner, which uses
+// the start of the linear section of the first move, but nothing before that can have moved it.
+// Returns false if the corner can't be blended.
+template <typename F>
+bool planner_t<F>::planCorner(const move& m0, const move& m1, bool isFirst, bool isLast, cornerBlend& b)
 {
+    // blends are worked out between straight lines
+    if ( isArcMove(m0) || isArcMove(m1) )
+        return false;
 
     int numPrevSegments = (int)m0.segments.size();
     int numNextSegments = (int)m1.segments.size();
 
     if ( ! (numPrevSegments == 5 || numPrevSegments == 7) ||
          ! (numNextSegments == 5 || numNextSegments == 7))
-        return;
+        return false;
 
-    scv::vec3 m0srcPos = m0.src;
-    scv::vec3 m0dstPos = m0.dst;
+    vec3 m0srcPos = m0.src;
+    vec3 m0dstPos = m0.dst;
 
-    scv::vec3 m1srcPos = m1.src;
-    scv::vec3 m1dstPos = m1.dst;
+    vec3 m1srcPos = m1.src;
+    vec3 m1dstPos = m1.dst;
 
-    scv::vec3 m0dir = m0dstPos - m0srcPos;
-    scv::vec3 m1dir = m1dstPos - m1srcPos;
+    vec3 m0dir = m0dstPos - m0srcPos;
+    vec3 m1dir = m1dstPos - m1srcPos;
     m0dir.Normalize();
     m1dir.Normalize();
 
     // find the constant speed sections in the middle of each move
-    segment& seg0 = numPrevSegments == 5 ? m0.segments[2] : m0.segments[3];
-    segment& seg1 = numNextSegments == 5 ? m1.segments[2] : m1.segments[3];
-    segment& seg2 = numNextSegments == 5 ? m1.segments[3] : m1.segments[4]; // segment after the outgoing linear phase
+    const segment& seg0 = numPrevSegments == 5 ? m0.segments[2] : m0.segments[3];
+    const segment& seg1 = numNextSegments == 5 ? m1.segments[2] : m1.segments[3];
+    const segment& seg2 = numNextSegments == 5 ? m1.segments[3] : m1.segments[4]; // segment after the outgoing linear phase
 
 
-    scv::vec3 v0 = seg0.vel;
-    scv::vec3 v1 = seg1.vel;
+    vec3 v0 = seg0.vel;
+    vec3 v1 = seg1.vel;
 
-    scv::vec3 dv = v1 - v0;
-    scv::vec3 jerkDir = dv;
+    vec3 dv = v1 - v0;
+    vec3 jerkDir = dv;
     jerkDir.Normalize();
 
-    scv::vec3 a = jerkDir;
-    scv::vec3 j = jerkDir;
+    vec3 a = jerkDir;
+    vec3 j = jerkDir;
 
     // in each axis, make these vectors too long, then trim them down
-    a *= (scv_float)1.5 * scv::max(accLimit.x, accLimit.y);
-    j *= (scv_float)1.5 * scv::max(jerkLimit.x, jerkLimit.y);
+    a *= (F)1.5 * scv::max(accLimit.x, accLimit.y);
+    j *= (F)1.5 * scv::max(jerkLimit.x, jerkLimit.y);
 
     if ( fabs(a.x) > accLimit.x )
-        a *= accLimit.x / (scv_float)fabs(a.x);
+        a *= accLimit.x / (F)fabs(a.x);
     if ( fabs(a.y) > accLimit.y )
-        a *= accLimit.y / (scv_float)fabs(a.y);
+        a *= accLimit.y / (F)fabs(a.y);
     if ( fabs(a.z) > accLimit.z )
-        a *= accLimit.z / (scv_float)fabs(a.z);
+        a *= accLimit.z / (F)fabs(a.z);
 
     if ( fabs(j.x) > jerkLimit.x )
-        j *= jerkLimit.x / (scv_float)fabs(j.x);
+        j *= jerkLimit.x / (F)fabs(j.x);
     if ( fabs(j.y) > jerkLimit.y )
-        j *= jerkLimit.y / (scv_float)fabs(j.y);
+        j *= jerkLimit.y / (F)fabs(j.y);
     if ( fabs(j.z) > jerkLimit.z )
-        j *= jerkLimit.z / (scv_float)fabs(j.z);
+        j *= jerkLimit.z / (F)fabs(j.z);
 
-    scv_float amag = a.Length();
-    scv_float jmag = j.Length();
+    F amag = a.Length();
+    F jmag = j.Length();
     if ( m0.acc < amag )
         a *= m0.acc / amag;
     if ( m0.jerk < jmag )
         j *= m0.jerk / jmag;
 
-    scv_float maxJerkLim = 1; // max allowable jerk for smooth velocity transition
+    F maxJerkLim = 1; // max allowable jerk for smooth velocity transition
 
     // at least one component of dv should be non-zero, so use the highest one for this part
     if ( fabs(dv.x) > 0 ) {
-        scv_float mjx = (a.x*a.x) / dv.x;
-        maxJerkLim = scv::min(maxJerkLim, (scv_float)fabsf(mjx / j.x));
+        F mjx = (a.x*a.x) / dv.x;
+        maxJerkLim = scv::min(maxJerkLim, (F)fabs(mjx / j.x));
     }
     if ( fabs(dv.y) > 0 ) {
-        scv_float mjy = (a.y*a.y) / dv.y;
-        maxJerkLim = scv::min(maxJerkLim, (scv_float)fabsf(mjy / j.y));
+        F mjy = (a.y*a.y) / dv.y;
+        maxJerkLim = scv::min(maxJerkLim, (F)fabs(mjy / j.y));
     }
     if ( fabs(dv.z) > 0 ) {
-        scv_float mjz = (a.z*a.z) / dv.z;
-        maxJerkLim = scv::min(maxJerkLim, (scv_float)fabsf(mjz / j.z));
+        F mjz = (a.z*a.z) / dv.z;
+        maxJerkLim = scv::min(maxJerkLim, (F)fabs(mjz / j.z));
     }
 
     if ( maxJerkLim < 1 ) { // only use this to reduce jerk
@@ -887,22 +2942,22 @@ void planner::blendCorner(move& m0, move& m1, bool isFirst, bool isLast)
     }
 
 
-    scv::vec3 earliestStart;
-    scv::vec3 latestStart;
-    scv::vec3 earliestEnd;
-    scv::vec3 latestEnd;
+    vec3 earliestStart;
+    vec3 latestStart;
+    vec3 earliestEnd;
+    vec3 latestEnd;
 
-    scv_float maxJerkLength = 0;
+    F maxJerkLength = 0;
 
 
-    scv_float T = 0;
+    F T = 0;
 
-    scv::vec3 startPoint = 0.5 * (m0srcPos + m0dstPos);
-    scv::vec3 endPoint =   0.5 * (m1srcPos + m1dstPos);
+    vec3 startPoint = 0.5 * (m0srcPos + m0dstPos);
+    vec3 endPoint =   0.5 * (m1srcPos + m1dstPos);
 
     if ( dv.Length() < 0.00001 ) {
-        scv_float distance = (endPoint - startPoint).Length();
-        T = (scv_float)0.5 * distance / v0.Length();
+        F distance = (endPoint - startPoint).Length();
+        T = (F)0.5 * distance / v0.Length();
     }
     else {
         T = calculateDurationFromJerkAndAcceleration(j, v1-v0);
@@ -910,19 +2965,19 @@ void planner::blendCorner(move& m0, move& m1, bool isFirst, bool isLast)
 
     bool doubleBack = false;
 
-    scv_float dot = scv::dot(m1dir, m0dir);
-    dot = scv::min( (scv_float)1.0, scv::max((scv_float) - 1.0, dot));
-    scv_float angleToTurn = (scv_float)acos( dot );
+    F dot = scv::dot(m1dir, m0dir);
+    dot = scv::min( (F)1.0, scv::max((F) - 1.0, dot));
+    F angleToTurn = (F)acos( dot );
     if ( angleToTurn < 0.00001 ) {
 
         // easy case where movement doesn't turn
 
-        scv_float t = T;
+        F t = T;
 
-        scv::vec3 maxJerkEndPoint = 2 * t * v0    +    (t * t * t) * j;
+        vec3 maxJerkEndPoint = 2 * t * v0    +    (t * t * t) * j;
         maxJerkLength = maxJerkEndPoint.Length();
 
-        segment& seg0After =  numPrevSegments == 5 ? m0.segments[3] : m0.segments[4];
+        const segment& seg0After =  numPrevSegments == 5 ? m0.segments[3] : m0.segments[4];
 
         earliestStart = startPoint;
         latestEnd = endPoint;
@@ -934,20 +2989,20 @@ void planner::blendCorner(move& m0, move& m1, bool isFirst, bool isLast)
 
         // A special annoying case of movement going back in the exact direction it came from.
 
-        scv_float curveSpan = 0; // the furthest point the deceleration curve will reach, measured from the start (or finish) point, whichever is furthest
+        F curveSpan = 0; // the furthest point the deceleration curve will reach, measured from the start (or finish) point, whichever is furthest
 
-        scv_float qa = j.Length() / (scv_float)2.0;
-        scv_float qb = 0;
-        scv_float qc = -v0.Length();
-        scv_float x0 = -99999;
-        scv_float x1 = -99999;
+        F qa = j.Length() / (F)2.0;
+        F qb = 0;
+        F qc = -v0.Length();
+        F x0 = -99999;
+        F x1 = -99999;
         gsl_poly_solve_quadratic( qa, qb, qc, &x0, &x1 );
-        scv_float t = scv::max(x0, x1);
+        F t = scv::max(x0, x1);
 
-        scv::vec3 p0 =      (t * v0) + (( t * t * t) / (scv_float)6.0) * j; // furthest point reached in first half of reversal
+        vec3 p0 =      (t * v0) + (( t * t * t) / (F)6.0) * j; // furthest point reached in first half of reversal
         curveSpan = scv::max(curveSpan, p0.Length());
 
-        qa = j.Length() / (scv_float)2.0;
+        qa = j.Length() / (F)2.0;
         qb = 0;
         qc = -v1.Length();
         x0 = 0;
@@ -955,20 +3010,20 @@ void planner::blendCorner(move& m0, move& m1, bool isFirst, bool isLast)
         gsl_poly_solve_quadratic( qa, qb, qc, &x0, &x1 );
         t = scv::max(x0, x1);
 
-        scv::vec3 p1 = (t * v1) + ((t * t * t) / (scv_float)6.0) * -j; // furthest point reached in second half of reversal
+        vec3 p1 = (t * v1) + ((t * t * t) / (F)6.0) * -j; // furthest point reached in second half of reversal
         curveSpan = scv::max(curveSpan, p1.Length());
 
         t = T;
-        scv::vec3 maxJerkDelta = 2 * t * v0    +    (t * t * t) * j;
+        vec3 maxJerkDelta = 2 * t * v0    +    (t * t * t) * j;
 
-        scv_float longestAllowableLength = (startPoint - m0dstPos).Length();
+        F longestAllowableLength = (startPoint - m0dstPos).Length();
         longestAllowableLength = scv::min(longestAllowableLength, (endPoint - m0dstPos).Length());
         if ( longestAllowableLength == 0 )
-            return; // impossible
+            return false; // impossible
 
-        scv_float ratio = (curveSpan + maxJerkDelta.Length()) / longestAllowableLength;
+        F ratio = (curveSpan + maxJerkDelta.Length()) / longestAllowableLength;
         if ( ratio > 1 )
-            return; // not enough room
+            return false; // not enough room
 
         if ( m1.blendType == CBT_MIN_JERK ) {
             j *= ratio*ratio;
@@ -979,7 +3034,7 @@ void planner::blendCorner(move& m0, move& m1, bool isFirst, bool isLast)
             maxJerkDelta *= 1 / ratio;
         }
 
-        scv::vec3 v0dir = v0;
+        vec3 v0dir = v0;
         v0dir.Normalize();
         startPoint = m0dstPos + -curveSpan * v0dir;
         endPoint = startPoint; // will change below
@@ -995,17 +3050,17 @@ void planner::blendCorner(move& m0, move& m1, bool isFirst, bool isLast)
     }
     else {
 
-        scv_float t = T;
+        F t = T;
 
-        scv::vec3 finalVelocity = v0 + t * t * j;
+        vec3 finalVelocity = v0 + t * t * j;
         finalVelocity.Normalize();
 
 
-        scv::vec3 curveEndPoint = 2 * t * v0    +    (t * t * t) * j;
+        vec3 curveEndPoint = 2 * t * v0    +    (t * t * t) * j;
 
 
         // find the usable start and end of each constant speed section
-        scv::vec3 seg0Start, seg0End, seg1Start, seg1End;
+        vec3 seg0Start, seg0End, seg1Start, seg1End;
 
         seg0Start = 0.5 * (m0srcPos + m0dstPos); // earliest start is at middle of preceding move
         seg0End = m0dstPos; // latest start is at end of preceding move
@@ -1015,9 +3070,9 @@ void planner::blendCorner(move& m0, move& m1, bool isFirst, bool isLast)
 
         if ( isFirst && m1.blendType == CBT_MIN_JERK ) {
             if ( m1.blendClearance >= 0 ) {
-                scv_float distanceToMid = (seg0Start - m0srcPos).Length();
-                scv_float distanceToEarliest = (seg0.pos - m0srcPos).Length();
-                scv_float useClearance = max(distanceToEarliest, min(m1.blendClearance, distanceToMid));
+                F distanceToMid = (seg0Start - m0srcPos).Length();
+                F distanceToEarliest = (seg0.pos - m0srcPos).Length();
+                F useClearance = max(distanceToEarliest, min(m1.blendClearance, distanceToMid));
                 seg0Start = m0srcPos + useClearance * m0dir;
             }
             else
@@ -1025,35 +3080,35 @@ void planner::blendCorner(move& m0, move& m1, bool isFirst, bool isLast)
         }
         else if ( isLast && m1.blendType == CBT_MIN_JERK ) {
             if ( m1.blendClearance >= 0 ) {
-                scv_float distanceToMid = (seg1End - m1dstPos).Length();
-                scv_float distanceToLatest = (seg2.pos - m1dstPos).Length();
-                scv_float useClearance = max(distanceToLatest, min(m1.blendClearance, distanceToMid));
+                F distanceToMid = (seg1End - m1dstPos).Length();
+                F distanceToLatest = (seg2.pos - m1dstPos).Length();
+                F useClearance = max(distanceToLatest, min(m1.blendClearance, distanceToMid));
                 seg1End = m1dstPos - useClearance * m1dir;
             }
             else
                 seg1End = seg2.pos;
         }
 
-        scv::vec3 projBase = m0dstPos;
+        vec3 projBase = m0dstPos;
 
-        scv::vec3 curveEndPointNormalized = curveEndPoint;
+        vec3 curveEndPointNormalized = curveEndPoint;
         curveEndPointNormalized.Normalize();
-        scv_float dummy;
-        scv::vec3 cpoSpan = getClosestPointOnInfiniteLine( m0srcPos, curveEndPointNormalized, projBase, &dummy);
+        F dummy;
+        vec3 cpoSpan = getClosestPointOnInfiniteLine( m0srcPos, curveEndPointNormalized, projBase, &dummy);
 
-        scv::vec3 dirForProjection = projBase - cpoSpan;
+        vec3 dirForProjection = projBase - cpoSpan;
 
         dirForProjection.Normalize();
 
-        scv_float A0, A1, B0, B1;
+        F A0, A1, B0, B1;
 
         getClosestPointOnInfiniteLine( projBase, dirForProjection, seg0Start, &A0);
         getClosestPointOnInfiniteLine( projBase, dirForProjection, seg0End, &A1 );
         getClosestPointOnInfiniteLine( projBase, dirForProjection, seg1Start, &B0 );
         getClosestPointOnInfiniteLine( projBase, dirForProjection, seg1End, &B1 );
 
-        scv_float D0 = A1;
-        scv_float D1 = B0;
+        F D0 = A1;
+        F D1 = B0;
 
         D0 = A0;
         D1 = B1;
@@ -1067,18 +3122,18 @@ void planner::blendCorner(move& m0, move& m1, bool isFirst, bool isLast)
         if (( A0 > B0 && A0 > B1) ||
             ( A1 < B0 && A1 < B1)) {
             // no overlap between constant velocity sections
-            return;
+            return false;
         }
 
-        scv_float ds[4];
+        F ds[4];
         ds[0] = A0;
         ds[1] = A1;
         ds[2] = B0;
         ds[3] = B1;
         std::sort(std::begin(ds), std::end(ds));
 
-        scv_float inner = ds[1];
-        scv_float outer = ds[2];
+        F inner = ds[1];
+        F outer = ds[2];
         if ( fabs(inner) > fabs(outer) )
             std::swap(inner, outer);
 
@@ -1090,13 +3145,13 @@ void planner::blendCorner(move& m0, move& m1, bool isFirst, bool isLast)
         maxJerkLength = curveEndPoint.Length();
     }
 
-    scv_float shortestAllowableLength = (latestStart - earliestEnd).Length();  // higher jerk
-    scv_float longestAllowableLength = (earliestStart - latestEnd).Length(); // lower jerk
+    F shortestAllowableLength = (latestStart - earliestEnd).Length();  // higher jerk
+    F longestAllowableLength = (earliestStart - latestEnd).Length(); // lower jerk
 
     if ( longestAllowableLength != 0 ) {
         if ( maxJerkLength > (longestAllowableLength + 0.0000001) ) {
             // jerk limit does not allow turning as tight as required
-            return;
+            return false;
         }
     }
 
@@ -1107,7 +3162,7 @@ void planner::blendCorner(move& m0, move& m1, bool isFirst, bool isLast)
     else if ( m1.blendType == CBT_MAX_JERK ) {
         if ( maxJerkLength <= shortestAllowableLength ) {
             // lower jerk to fit shortest allowable curve
-            scv_float ratio = maxJerkLength / shortestAllowableLength;
+            F ratio = maxJerkLength / shortestAllowableLength;
             j *= ratio*ratio;
             T = calculateDurationFromJerkAndAcceleration(j, v1-v0);
             startPoint = latestStart;
@@ -1115,9 +3170,9 @@ void planner::blendCorner(move& m0, move& m1, bool isFirst, bool isLast)
         }
         else {
             // jerk is already between the limits, just need to position the start correctly
-            scv_float f = (scv_float)fabs((maxJerkLength - shortestAllowableLength) / (longestAllowableLength - shortestAllowableLength));
-            scv::vec3 midStart = latestStart + f * (earliestStart - latestStart);
-            scv::vec3 midEnd = earliestEnd + f * (latestEnd - earliestEnd);
+            F f = (F)fabs((maxJerkLength - shortestAllowableLength) / (longestAllowableLength - shortestAllowableLength));
+            vec3 midStart = latestStart + f * (earliestStart - latestStart);
+            vec3 midEnd = earliestEnd + f * (latestEnd - earliestEnd);
             startPoint = midStart;
             endPoint = midEnd;
         }
@@ -1128,7 +3183,7 @@ void planner::blendCorner(move& m0, move& m1, bool isFirst, bool isLast)
 
         }
         else if ( longestAllowableLength != 0 ) { // a move that doubles back can have a zero length
-            scv_float ratio = maxJerkLength / longestAllowableLength;
+            F ratio = maxJerkLength / longestAllowableLength;
             j *= ratio*ratio;
             T = calculateDurationFromJerkAndAcceleration(j, v1-v0);
         }
@@ -1137,189 +3192,550 @@ void planner::blendCorner(move& m0, move& m1, bool isFirst, bool isLast)
         endPoint = latestEnd;
     }
 
+    b.startPoint = startPoint;
+    b.endPoint = endPoint;
+    b.v0 = v0;
+    b.j = j;
+    b.T = T;
+    return true;
+}
+
+// Applies a planned corner blend to the move before the corner. The linear section now stops where
+// the blend starts, the rest of the move is dropped, and the blend segments are added at the end.
+template <typename F>
+static void applyCornerToIncoming(move_t<F>& m0, const cornerBlend_t<F>& b)
+{
+    segment_t<F>& seg0 = m0.segments.size() == 5 ? m0.segments[2] : m0.segments[3];
+
     // remove latter part of linear segment of original first line
-    scv_float linear0Len = (startPoint - seg0.pos).Length();
+    F linear0Len = (b.startPoint - seg0.pos).Length();
     seg0.duration = linear0Len / seg0.vel.Length();
 
-    // remove first part of linear segment of original second line
-    scv_float linear1Len = (seg2.pos - endPoint).Length();
-    seg1.duration = linear1Len / seg1.vel.Length();
-    seg1.pos = endPoint;
-
     markSkippedSegments(m0, 0);
-    markSkippedSegments(m1, 1);
 
     // update midpoint values
-    scv_float t = T;
-    scv::vec3 sh =      t * v0 + (( t * t * t) / (scv_float)6.0) * j;
-    scv::vec3 vh = v0 + ((t * t) / (scv_float)2.0) * j;
-    scv::vec3 ah =      t * j;
-
-    segment c0;
-    c0.pos = startPoint;
-    c0.vel = v0;
-    c0.acc = scv::vec3_zero;
-    c0.jerk = j;
-    c0.duration = T;
+    F t = b.T;
+    vec3_t<F> sh =      t * b.v0 + (( t * t * t) / (F)6.0) * b.j;
+    vec3_t<F> vh = b.v0 + ((t * t) / (F)2.0) * b.j;
+    vec3_t<F> ah =      t * b.j;
+
+    segment_t<F> c0;
+    c0.pos = b.startPoint;
+    c0.vel = b.v0;
+    c0.acc = vec3_t<F>(0, 0, 0);
+    c0.jerk = b.j;
+    c0.duration = b.T;
     m0.segments.push_back(c0);
 
-    segment c1;
-    c1.pos = sh + startPoint;
+    segment_t<F> c1;
+    c1.pos = sh + b.startPoint;
     c1.vel = vh;
     c1.acc = ah;
-    c1.jerk = -j;
-    c1.duration = T;
+    c1.jerk = -b.j;
+    c1.duration = b.T;
     m0.segments.push_back(c1);
 }
 
-void planner::appendMove(move &m)
+// Applies a planned corner blend to the move after the corner. The linear section now starts where
+// the blend ends, and the part of the move before that is dropped. This must be done before the
+// corner at the other end of the move is applied to it, since that uses where the linear section starts.
+template <typename F>
+static void applyCornerToOutgoing(move_t<F>& m1, const cornerBlend_t<F>& b)
 {
-    if ( m.vel == 0 ) {
-        printf("Ignoring move with zero velocity\n");
-        return;
-    }
-    if ( m.acc == 0 ) {
-        printf("Ignoring move with zero acceleration\n");
+    int numSegments = (int)m1.segments.size();
+    segment_t<F>& seg1 = numSegments == 5 ? m1.segments[2] : m1.segments[3];
+    segment_t<F>& seg2 = numSegments == 5 ? m1.segments[3] : m1.segments[4]; // segment after the outgoing linear phase
+
+    // remove first part of linear segment of original second line
+    F linear1Len = (seg2.pos - b.endPoint).Length();
+    seg1.duration = linear1Len / seg1.vel.Length();
+    seg1.pos = b.endPoint;
+
+    markSkippedSegments(m1, 1);
+}
+
+template <typename F>
+void planner_t<F>::blendCorner(move& m0, move& m1, bool isFirst, bool isLast)
+{
+    cornerBlend b;
+    if ( ! planCorner(m0, m1, isFirst, isLast, b) )
         return;
-    }
-    if ( m.jerk == 0 ) {
-        printf("Ignoring move with zero jerk\n");
+
+    applyCornerToOutgoing(m1, b);
+    applyCornerToIncoming(m0, b);
+}
+
+template <typename F>
+void planner_t<F>::appendMove(move &m)
+{
+    if ( ! hasMoveLimits(m) ) {
+        printf("Ignoring move with invalid limits\n");
         return;
     }
 
     if ( ! moves.empty() ) {
         move& lastMove = moves[moves.size()-1];
         m.src = lastMove.dst;
-        if ( m.src == m.dst ) {
+        if ( m.src == m.dst && ! isArcMove(m) && ! isDwellMove(m) ) {
             printf("Ignoring move with no actual dp\n");
             return;
         }
     }
 
     moves.push_back(m);
+    moves.back().segments = moveSegments(); // a copy of another move still refers to its slot
+
+    if ( streaming ) {
+        giveSegmentSlot(moves.back());
+        calculateMove(moves.back());
+        advanceStream(false);
+    }
+    else if ( replan_inputs.size() + 1 == moves.size() && moveFirstSegment.size() == moves.size() ) {
+        // no segments until the next calculateMoves, but replanning needs the slot
+        giveSegmentSlot(moves.back());
+        replan_inputs.push_back(moveInputs());
+        moveFirstSegment.push_back(moveFirstSegment.back());
+    }
+    // Otherwise everything is calculated again and assignAllSegmentSlots sizes the pool for all the
+    // moves at once, rather than it growing one slot at a time while a path is being loaded.
 }
 
-void planner::collateSegments()
+template <typename F>
+void planner_t<F>::insertMove(size_t index, move& m)
 {
-    segments.clear();
-    tagScalars();
+    if ( ! hasMoveLimits(m) ) {
+        printf("Ignoring move with invalid limits\n");
+        return;
+    }
 
-    for (size_t i = 0; i < moves.size(); i++)
-    {
-        move& m = moves[i];
-        for (size_t k = 0; k < m.segments.size(); k++)
-        {
-            segment& s = m.segments[k];
-            if (s.duration > 0)
-            {
-                segments.push_back(s);
-            }
-        }
+    index = min(index, moves.size());
+    vec3 src = index > 0 ? moves[index-1].dst : (moves.empty() ? m.src : moves[0].src);
+    if ( (src == m.dst && ! isArcMove(m) && m.dwell <= 0) || (index < moves.size() && moves[index].dst == m.dst && ! isArcMove(moves[index]) && moves[index].dwell <= 0) ) {
+        printf("Ignoring move with no actual dp\n");
+        return;
+    }
+
+    replaceMoves(index, 0, &m, 1);
+}
+
+template <typename F>
+void planner_t<F>::eraseMove(size_t index)
+{
+    if ( index < moves.size() )
+        replaceMoves(index, 1, 0, 0);
+}
+
+// Replaces 'count' moves starting from 'first' with newMoves. The new moves start from the dst of the
+// move before them (or the src of the first move), and the move after them now starts from the dst of
+// the last new move. The segments of the removed moves are taken out of the table straight away, so
+// that the table stays in step with the moves.
+template <typename F>
+void planner_t<F>::replaceMoves(size_t first, size_t count, const std::vector<move>& newMoves)
+{
+    replaceMoves(first, count, newMoves.data(), newMoves.size());
+}
+
+template <typename F>
+void planner_t<F>::replaceMoves(size_t first, size_t count, const move* newMoves, size_t numNewMoves)
+{
+    if ( streaming ) {
+        printf("Moves can not be edited in streaming mode!\n");
+        return;
+    }
+
+    first = min(first, moves.size());
+    count = min(count, moves.size() - first);
+
+    vec3 start = vec3(0, 0, 0);
+    if ( first > 0 )
+        start = moves[first-1].dst;
+    else if ( ! moves.empty() )
+        start = moves[0].src;
+    else if ( numNewMoves > 0 )
+        start = newMoves[0].src;
+
+    bool aligned = replan_inputs.size() == moves.size() && moveFirstSegment.size() == moves.size() + 1;
+    int firstRow = 0;
+    int numRows = 0;
+    if ( aligned ) {
+        firstRow = moveFirstSegment[first];
+        numRows = moveFirstSegment[first+count] - firstRow;
+    }
+
+    for (size_t i = first; i < first + count; i++)
+        freeSegmentSlot(moves[i]);
+    moves.erase(moves.begin() + first, moves.begin() + first + count);
+    moves.insert(moves.begin() + first, newMoves, newMoves + numNewMoves);
+    size_t end = first + numNewMoves;
+    for (size_t i = first; i < end; i++)
+        moves[i].segments = moveSegments();
+    for (size_t i = first; i < end; i++)
+        giveSegmentSlot(moves[i]);
+    for (size_t i = first; i <= end && i < moves.size(); i++)
+        moves[i].src = i > first ? moves[i-1].dst : start;
+
+    if ( ! aligned ) {
+        replan_inputs.clear(); // everything will be calculated again anyway
+        return;
     }
 
-    calculateScalars();
+    segments.replace(firstRow, numRows, segmentTable());
+    moveFirstSegment.erase(moveFirstSegment.begin() + first, moveFirstSegment.begin() + first + count);
+    moveFirstSegment.insert(moveFirstSegment.begin() + first, numNewMoves, firstRow);
+    for (size_t i = end; i < moveFirstSegment.size(); i++)
+        moveFirstSegment[i] -= numRows;
 
+    replan_inputs.erase(replan_inputs.begin() + first, replan_inputs.begin() + first + count);
+    replan_inputs.insert(replan_inputs.begin() + first, numNewMoves, moveInputs());
+
+    // the moves either side now join up to different moves
+    if ( first > 0 )
+        replan_inputs[first-1].valid = false;
+    if ( end < moves.size() )
+        replan_inputs[end].valid = false;
+
+    if ( count != numNewMoves && (replan_shiftedFrom < 0 || (int)first < replan_shiftedFrom) )
+        replan_shiftedFrom = (int)first;
 }
 
+// Whether moves first to last-1 can be replaced by a single move from the src of the first to the dst
+// of the last. The scaler goes linearly from the scaler before the first move to the scaler of the last
+// move, so the scaler of each point in between is checked too, as the distance along the merged move
+// between that point and where the merged move reaches the same scaler value.
+template <typename F>
+bool planner_t<F>::canMergeMoves(size_t first, size_t last, F tolerance)
+{
+    const move& m0 = moves[first];
+    const move& m1 = moves[last-1];
+    for (size_t i = first; i < last; i++)
+        if ( isArcMove(moves[i]) || isDwellMove(moves[i]) )
+            return false;
+
+    vec3 origin = m0.src;
+    vec3 dir = m1.dst - origin;
+    F len = dir.Normalize();
+    if ( len == 0 )
+        return false;
+
+    F scalerStart = first > 0 ? moves[first-1].scaler : 0;
+    F scalerChange = m1.scaler - scalerStart;
+    F toleranceSq = tolerance * tolerance;
+
+    for (size_t i = first + 1; i < last; i++) {
+        const move& m = moves[i];
+        if ( m.vel != m0.vel || m.acc != m0.acc || m.jerk != m0.jerk ||
+             m.blendType != m0.blendType || m.blendClearance != m0.blendClearance )
+            return false;
+
+        // the point between moves i-1 and i
+        const move& prev = moves[i-1];
+        vec3 offset = prev.dst - origin;
+        F along = min(max(dot(offset, dir), (F)0), len);
+        if ( (offset - along * dir).LengthSquared() > toleranceSq )
+            return false;
 
+        F scalerError = (F)fabs(prev.scaler - (scalerStart + scalerChange * (along / len)));
+        if ( scalerError * len > tolerance * (F)fabs(scalerChange) )
+            return false;
+    }
+    return true;
+}
 
-void planner::calculateScalars()
+template <typename F>
+size_t planner_t<F>::simplifyMoves(F tolerance)
 {
-    for (size_t i = 0; i < segments.size() - 1; i++)
-    {
-        auto endPos = segments[i].endPos;
-        auto curPos = segments[i].pos;
-        if (segments[i].duration > 0.0)
-        {
-            if (endPos == curPos)
-            {
-                auto m = moves[segments[i].moveOwner + 1];
-                auto m_old = moves[segments[i].moveOwner];
-                segments[i].endPos = m.dst;
-                segments[i].startPos = m.src;
-                segments[i].scaler_start = m_old.scaler;
-            }
-        }
+    if ( streaming ) {
+        printf("Moves can not be simplified in streaming mode!\n");
+        return 0;
     }
-    for (size_t i = 0; i < segments.size() - 1; i++)
-    {
 
-        auto endPos = segments[i].endPos;
-        auto curPos = segments[i].pos;
-        if (segments[i].duration > 0.0)
-        {
-            if (endPos == curPos)
-            {
-                auto m = moves[segments[i].moveOwner + 1];
-                auto m_old = moves[segments[i].moveOwner];
-                segments[i].endPos = m.dst;
-                segments[i].startPos = m.src;
-                segments[i].scaler_start = m_old.scaler;
+    size_t numMoves = moves.size();
+    if ( tolerance <= 0 || numMoves < 2 )
+        return 0;
+
+    // Each run of moves that can be merged becomes its first move, stretched to the end of the run. The
+    // end of the run is found by trying runs of doubling length and then a binary search between the
+    // last two tried, since checking a run takes time in proportion to its length. Only runs that have
+    // been checked are merged, so this can only miss out on a few merges where a longer run would fit
+    // but a shorter one wouldn't.
+    size_t numKept = 0;
+    size_t first = 0;
+    while ( first < numMoves ) {
+        size_t last = first + 1;    // end of the longest run found so far (one past its last move)
+        size_t step = 1;
+        while ( last < numMoves ) {
+            size_t tryLast = min(last + step, numMoves);
+            if ( canMergeMoves(first, tryLast, tolerance) ) {
+                last = tryLast;
+                step *= 2;
+                continue;
             }
+            size_t bad = tryLast;
+            while ( bad - last > 1 ) {
+                size_t mid = last + (bad - last) / 2;
+                if ( canMergeMoves(first, mid, tolerance) )
+                    last = mid;
+                else
+                    bad = mid;
+            }
+            break;
         }
+
+        for (size_t i = first + 1; i < last; i++)
+            freeSegmentSlot(moves[i]);
+        move merged = moves[first];
+        merged.dst = moves[last-1].dst;
+        merged.scaler = moves[last-1].scaler;
+        moves[numKept++] = merged;
+
+        first = last;
     }
-    /*
-    auto prev_seg = segments[0];
-    for (size_t i = 1; i < segments.size() - 1; i++)
-    {
-        if ((prev_seg.consecutiveNumber + 1) != segments[i].consecutiveNumber)
-        {
-            for (size_t j = i; j < segments.size() - 1; j++)
-            {
-                auto m_old = moves[segments[j-1].moveOwner];
-                segments[j].scaler_start = m_old.scaler;
-            }
+
+    if ( numKept == numMoves )
+        return 0;
+
+    moves.resize(numKept);
+    replan_inputs.clear(); // calculate everything again
+    return numMoves - numKept;
+}
+
+template <typename F>
+bool planner_t<F>::beginStream(streamCallback callback, void* userData)
+{
+    if ( blendMethod == CBM_INTERPOLATED_MOVES ) {
+        printf("Streaming is not supported with interpolated moves!\n");
+        return false;
+    }
+    if ( junctionSpeeds ) {
+        printf("Streaming is not supported with junction speeds!\n");
+        return false;
+    }
+    if ( ! checkGlobalLimits() ) {
+        printf("Can't start streaming due to invalid global limits!\n");
+        return false;
+    }
+
+    clear();
+    streaming = true;
+    stream_callback = callback;
+    stream_userData = userData;
+    stream_firstMove = 0;
+    stream_numBlended = 0;
+    stream_segmentId = 0;
+    stream_scalerStart = 0;
+    stream_time = 0;
+    return true;
+}
+
+// Gives out the remaining moves, now that it's known which one is last
+template <typename F>
+void planner_t<F>::endStream()
+{
+    if ( ! streaming )
+        return;
+
+    advanceStream(true);
+
+    streaming = false;
+    stream_callback = 0;
+    stream_userData = 0;
+    clear();
+}
+
+// Blends whatever corners can be blended, and gives out the moves that are then final. This does
+// the same work as calculateMoves and collateSegments, but one move at a time.
+template <typename F>
+void planner_t<F>::advanceStream(bool isEnd)
+{
+    // The blend of a corner depends on whether the move after it is the last one, so it has
+    // to wait for one more move to arrive (or the end of the stream).
+    while ( stream_numBlended < (int)moves.size() && (isEnd || stream_numBlended + 1 < (int)moves.size()) ) {
+        int i = stream_numBlended;
+        int moveIndex = stream_firstMove + i;
+        if ( blendMethod == CBM_CONSTANT_JERK_SEGMENTS && moveIndex > 0 && moves[i].blendType != CBT_NONE ) {
+            bool isFirst = moveIndex == 1;
+            bool isLast = isEnd && i == (int)moves.size() - 1;
+            blendCorner( moves[i-1], moves[i], isFirst, isLast );
         }
-        prev_seg = segments[i];
+        stream_numBlended++;
+    }
+
+    // A move is final once the corners on both sides of it have been blended
+    while ( stream_numBlended >= 2 || (isEnd && ! moves.empty()) )
+        emitStreamMove();
+}
+
+// Collates the segments of moves[0] and gives them to the stream callback, then drops the move
+template <typename F>
+void planner_t<F>::emitStreamMove()
+{
+    move& m = moves[0];
+
+    if ( blendMethod == CBM_CONSTANT_JERK_SEGMENTS )
+        removeSkippedSegments(m);
+
+    segments.clear();
+    segments.resize(countCollatedSegments(m));
+    collateMove(segments, 0, 0, stream_segmentId, stream_scalerStart);
+    stream_segmentId += (int)m.segments.size();
+    stream_scalerStart = m.scaler;
+
+    double startTime = stream_time;
+    segmentStartTimes.resize(segments.size() + 1);
+    for (size_t i = 0; i < segments.size(); i++) {
+        segmentStartTimes[i] = stream_time;
+        stream_time += segments.duration[i];
     }
-    */
-    return;
+    segmentStartTimes[segments.size()] = stream_time;
+    segmentStartDistances.clear();
+    lookup_segmentIndex = 0;
+
+    if ( stream_callback && ! segments.empty() )
+        stream_callback(segments, startTime, stream_userData);
+
+    freeSegmentSlot(m);
+    moves.erase(moves.begin());
+    stream_firstMove++;
+    stream_numBlended--;
 }
 
-void planner::tagScalars()
+template <typename F>
+void planner_t<F>::collateSegments()
 {
-    size_t id = 0;
-    auto scaler_start = 0;
+    // Where each move's segments go is a running total, but after that the moves can be collated
+    // separately. The scaler of each move carries on from the move before it.
+    moveFirstSegment.resize(moves.size() + 1);
+    std::pmr::vector<int>& firstIds = calc_firstIds;
+    firstIds.resize(moves.size());
+    int row = 0;
+    int id = 0;
     for (size_t i = 0; i < moves.size(); i++)
     {
-        move& m = moves[i];
-        for (size_t k = 0; k < m.segments.size(); k++)
+        moveFirstSegment[i] = row;
+        firstIds[i] = id;
+        row += (int)countCollatedSegments(moves[i]);
+        id += (int)moves[i].segments.size();
+    }
+    moveFirstSegment[moves.size()] = row;
+
+    segments.clear();
+    segments.resize(row);
+    parallelFor(0, moves.size(), numThreads, parallelGrain, [&](size_t i) {
+        collateMove(segments, moveFirstSegment[i], i, firstIds[i], i > 0 ? moves[i-1].scaler : 0);
+    });
+
+    updateSegmentStartTimes(0);
+}
+
+// Fills in the segments of moves[moveInd] and their info in 'table', starting at 'row'. The table must
+// already have room for them (see countCollatedSegments). The segments are numbered from 'firstId'
+// (counting the zero length segments that are left out), and the scaler carries on from 'scalerStart',
+// the scaler of the move before. A segment that starts at the end of its move interpolates its scaler
+// along the next move instead, except at the end of the path. The scaler of each segment is finished
+// here too, while its row is still in the cache.
+template <typename F>
+void planner_t<F>::collateMove(segmentTable& table, size_t row, size_t moveInd, int firstId, F scalerStart)
+{
+    move& m = moves[moveInd];
+    int moveIndex = stream_firstMove + (int)moveInd;
+    bool haveNextMove = moveInd + 1 < moves.size();
+
+    scalerLine<F> ownLine(m);
+    scalerLine<F> nextLine = haveNextMove ? scalerLine<F>(moves[moveInd+1]) : ownLine;
+    bool isArc = isArcMove(m);
+    arcPath<F> arc = isArc ? arcPath<F>(m) : arcPath<F>();
+    F turned = 0;
+
+    for (size_t k = 0; k < m.segments.size(); k++)
+    {
+        segment& s = m.segments[k];
+        if ( s.duration > 0 )
         {
-            m.segments[k].endPos = m.dst;
-            m.segments[k].startPos = m.src;
-            m.segments[k].scaler = m.scaler - scaler_start;
-            m.segments[k].scaler_start = scaler_start;
-            m.segments[k].consecutiveNumber = id++;
-            m.segments[k].moveOwner = i;
+            segmentInfo si;
+            si.scaler = m.scaler - scalerStart;
+            si.scaler_start = scalerStart;
+            si.scalerMove = moveIndex;
+            si.consecutiveNumber = firstId + (int)k;
+            si.moveOwner = moveIndex;
+            bool onNextMove = haveNextMove && ! isArc && m.dst == s.pos; // a full circle starts at its dst
+            if ( onNextMove ) {
+                si.scalerMove = moveIndex + 1;
+                si.scaler_start = m.scaler;
+            }
+            table.set(row, s, si);
+            if ( isArc )
+                setArcScalerPolynomial(table, row, arc, turned);
+            else
+                setScalerPolynomial(table, row, onNextMove ? nextLine : ownLine);
+            row++;
         }
-        scaler_start = m.scaler;
     }
-    return;
 }
 
+// Cumulative start times are kept in double precision, so that lookups late in a long
+// job don't suffer from the accumulated error of summing many short float durations.
+// Only the times from segment 'first' onwards are recalculated.
+template <typename F>
+void planner_t<F>::updateSegmentStartTimes(size_t first)
+{
+    segmentStartTimes.resize(segments.size() + 1);
+    double totalT = first > 0 ? segmentStartTimes[first-1] + segments.duration[first-1] : 0;
+    for (size_t i = first; i < segments.size(); i++) {
+        segmentStartTimes[i] = totalT;
+        totalT += segments.duration[i];
+    }
+    segmentStartTimes[segments.size()] = totalT;
+
+    // built on the first distance query, since most callers never need it
+    segmentStartDistances.clear();
+
+    // built on the next fixed step
+    fixedStep_startTicks.clear();
+    fixedStep_segmentEndTick = 0;
+
+    lookup_segmentIndex = 0;
+}
 
-void planner::setPositionLimits(scv_float lx, scv_float ly, scv_float lz, scv_float ux, scv_float uy, scv_float uz)
+template <typename F>
+void planner_t<F>::setPositionLimits(F lx, F ly, F lz, F ux, F uy, F uz)
 {
     posLimitLower = vec3(lx,ly,lz);
     posLimitUpper = vec3(ux,uy,uz);
 }
 
-void planner::setVelocityLimits(scv_float x, scv_float y, scv_float z)
+template <typename F>
+void planner_t<F>::setVelocityLimits(F x, F y, F z)
 {
     velLimit = vec3(x,y,z);
 }
 
-void planner::setAccelerationLimits(scv_float x, scv_float y, scv_float z)
+template <typename F>
+void planner_t<F>::setAccelerationLimits(F x, F y, F z)
 {
     accLimit = vec3(x,y,z);
 }
 
-void planner::setJerkLimits(scv_float x, scv_float y, scv_float z)
+template <typename F>
+void planner_t<F>::setJerkLimits(F x, F y, F z)
 {
     jerkLimit = vec3(x,y,z);
 }
 
-void planner::printConstraints()
+template <typename F>
+void planner_t<F>::setNumThreads(int n)
+{
+    numThreads = resolveNumThreads(n);
+}
+
+template <typename F>
+void planner_t<F>::setJunctionSpeeds(bool enable, F maxVelocityJump)
+{
+    junctionSpeeds = enable;
+    junctionMaxJump = max((F)0, maxVelocityJump);
+}
+
+template <typename F>
+void planner_t<F>::printConstraints()
 {
     printf("Planner global constraints:\n");
     printf("  Min pos:  %f, %f, %f\n", posLimitLower.x, posLimitLower.y, posLimitLower.z);
@@ -1329,7 +3745,8 @@ void planner::printConstraints()
     printf("  Max jerk: %f, %f, %f\n", jerkLimit.x, jerkLimit.y, jerkLimit.z);
 }
 
-void planner::printMoves()
+template <typename F>
+void planner_t<F>::printMoves()
 {
     for (size_t i = 0; i < moves.size(); i++) {
         move& m = moves[i];
@@ -1352,23 +3769,39 @@ void planner::printMoves()
     }
 }
 
-void planner::printSegments()
+template <typename F>
+void planner_t<F>::printSegments()
 {
     for (size_t i = 0; i < segments.size(); i++) {
-        segment& s = segments[i];
         printf("  Segment %d\n", (int)i);
-        printf("    pos : %f, %f, %f\n", s.pos.x, s.pos.y, s.pos.z);
-        printf("    vel : %f, %f, %f\n", s.vel.x, s.vel.y, s.vel.z);
-        printf("    acc : %f, %f, %f\n", s.acc.x, s.acc.y, s.acc.z);
-        printf("    jerk: %f, %f, %f\n", s.jerk.x, s.jerk.y, s.jerk.z);
-        printf("    duration: %f\n", s.duration);
+        vec3 pos = segments.getPos(i);
+        vec3 vel = segments.getVel(i);
+        vec3 acc = segments.getAcc(i);
+        vec3 jerk = segments.getJerk(i);
+        printf("    pos : %f, %f, %f\n", pos.x, pos.y, pos.z);
+        printf("    vel : %f, %f, %f\n", vel.x, vel.y, vel.z);
+        printf("    acc : %f, %f, %f\n", acc.x, acc.y, acc.z);
+        printf("    jerk: %f, %f, %f\n", jerk.x, jerk.y, jerk.z);
+        printf("    duration: %f\n", segments.duration[i]);
     }
 }
 
-std::vector<segment> &planner::getSegments()
+template <typename F>
+typename planner_t<F>::segmentTable& planner_t<F>::getSegments()
 {
     return segments;
 }
 
 
+template struct segmentTable_t<float>;
+template struct segmentTable_t<double>;
+template class planner_t<float>;
+template class planner_t<double>;
+template float evaluateSegmentScaler(const segmentInfo_t<float>& si, float t, const vec3_t<float>& pos, const vec3_t<float>& scalerSrc);
+template double evaluateSegmentScaler(const segmentInfo_t<double>& si, double t, const vec3_t<double>& pos, const vec3_t<double>& scalerSrc);
+template size_t sampleSegmentRun(const segmentTable_t<float>& segments, size_t row, double segmentStart, double segmentEnd, bool isLast, const vec3_t<float>& scalerSrc, int segmentIndex,
+                                 double t0, double dt, size_t first, size_t maxRun, sampleBuffers_t<float>& out, size_t count);
+template size_t sampleSegmentRun(const segmentTable_t<double>& segments, size_t row, double segmentStart, double segmentEnd, bool isLast, const vec3_t<double>& scalerSrc, int segmentIndex,
+                                 double t0, double dt, size_t first, size_t maxRun, sampleBuffers_t<double>& out, size_t count);
+
 } // namespace
@@ -1,33 +1,106 @@
 #ifndef SCV_PLANNER_H
 #define SCV_PLANNER_H
 
+#include <assert.h>
+#include <stdio.h>
 #include <vector>
+#include <memory_resource>
 #include "vec3.h"
 
 namespace scv {
 
+    // Everything below is a template on the floating point type F, built for float and double in planner.cpp.
+    // The plain names (planner, move etc.) are the scv_float versions. Planning in double and sampling in
+    // float is just a matter of converting the positions, see vec3_t.
+
     // A constant jerk portion of the trajectory, defined by an initial pos/vel/acc, and a jerk with duration
-    struct segment {
+    template <typename F>
+    struct segment_t {
+        typedef vec3_t<F> vec3;
 
         vec3 pos;
         vec3 vel;
         vec3 acc;
         vec3 jerk;
-        scv_float duration;
-        scv_float scaler = 0; //the location at start of segment
-        scv_float scaler_start = 0; //the location at start of segment
-        vec3 endPos;
-        vec3 startPos;
+        F duration;
 
         bool toDelete;
-        size_t consecutiveNumber;
-        size_t moveOwner;
 
-        segment() {
+        segment_t() {
             toDelete = false;
         }
     };
 
+    typedef segment_t<scv_float> segment;
+
+    // Details of a collated segment that are not needed to evaluate the trajectory
+    template <typename F>
+    struct segmentInfo_t {
+        F scaler;
+        F scaler_start; //the location at start of segment
+        int scalerMove;         // the scaler is interpolated between the src and dst of this move
+        int consecutiveNumber;
+        int moveOwner;
+
+        // If scalerIsPolynomial is set, the scaler at time t within the segment is the cubic
+        // scalerPoly[0] + scalerPoly[1]*t + scalerPoly[2]*t^2 + scalerPoly[3]*t^3. Otherwise it has to be
+        // found from the distance to the src of the scaler move, and scalerInvLength is 1/length of that move.
+        bool scalerIsPolynomial;
+        F scalerPoly[4];
+        F scalerInvLength;
+    };
+
+    typedef segmentInfo_t<scv_float> segmentInfo;
+
+    // The collated segments of the whole trajectory, as a structure of arrays. Only what is needed to
+    // evaluate the trajectory is kept in these arrays, so that lookups and traversal touch as little
+    // memory as possible. Everything else about each segment is in 'info'.
+    // The position within segment i is the cubic pos + vel*t + halfAcc*t^2 + sixthJerk*t^3, so the
+    // coefficients are stored already divided by 2 and 6. The position and velocity at the end of
+    // each segment are also stored, as they are needed whenever a segment is finished.
+    // The arrays take their memory from the given resource (the planner gives its own arena).
+    template <typename F>
+    struct segmentTable_t {
+        typedef vec3_t<F> vec3;
+        typedef segment_t<F> segment;
+        typedef segmentInfo_t<F> segmentInfo;
+
+        std::pmr::vector<F> posX, posY, posZ;
+        std::pmr::vector<F> velX, velY, velZ;
+        std::pmr::vector<F> halfAccX, halfAccY, halfAccZ;
+        std::pmr::vector<F> sixthJerkX, sixthJerkY, sixthJerkZ;
+        std::pmr::vector<F> duration;
+        std::pmr::vector<F> endPosX, endPosY, endPosZ;
+        std::pmr::vector<F> endVelX, endVelY, endVelZ;
+        std::pmr::vector<segmentInfo> info;
+
+        segmentTable_t(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+        size_t size() const { return duration.size(); }
+        bool empty() const { return duration.empty(); }
+        void clear();
+        void release();     // clear, and also give back the memory
+        void reserve(size_t n);
+        void resize(size_t n);
+        void push_back(const segment& s, const segmentInfo& si);
+        void set(size_t i, const segment& s, const segmentInfo& si);
+        void replace(size_t first, size_t count, const segmentTable_t& rows);  // replace 'count' segments from 'first' with all of 'rows'
+
+        vec3 getPos(size_t i) const { return vec3(posX[i], posY[i], posZ[i]); }
+        vec3 getVel(size_t i) const { return vec3(velX[i], velY[i], velZ[i]); }
+        vec3 getHalfAcc(size_t i) const { return vec3(halfAccX[i], halfAccY[i], halfAccZ[i]); }
+        vec3 getSixthJerk(size_t i) const { return vec3(sixthJerkX[i], sixthJerkY[i], sixthJerkZ[i]); }
+        vec3 getAcc(size_t i) const { return (F)2 * getHalfAcc(i); }
+        vec3 getJerk(size_t i) const { return (F)6 * getSixthJerk(i); }
+        vec3 getEndPos(size_t i) const { return vec3(endPosX[i], endPosY[i], endPosZ[i]); }
+        vec3 getEndVel(size_t i) const { return vec3(endVelX[i], endVelY[i], endVelZ[i]); }
+
+        // Position at time t after the start of segment i
+        void getPosition(size_t i, F t, vec3* pos) const;
+    };
+
+    typedef segmentTable_t<scv_float> segmentTable;
+
     enum cornerBlendMethod {
         CBM_NONE,
         CBM_CONSTANT_JERK_SEGMENTS,
@@ -40,42 +113,288 @@ namespace scv {
         CBT_MAX_JERK
     };
 
+    // The segments of a single move. These are kept in one buffer for all the moves (planner::segmentPool),
+    // which has a fixed size slot for each move so that calculating a move never allocates. A move has at
+    // most 7 segments of its own, and a corner blend at its end adds 2 more. Arcs are bent onto as many
+    // pieces as there is room for. The planner gives each move
+    // its slot when the move is added, or for a path that is going to be calculated again from the start,
+    // all at once when it is calculated. The segments are only valid for moves that are in the planner.
+    template <typename F>
+    struct moveSegments_t {
+        typedef segment_t<F> segment;
+
+        enum { capacity = 9 };
+
+        segment* items;     // the slot, or null if the move doesn't have one
+        int count;
+        int slot;           // index of the slot in the buffer, in units of 'capacity' segments
+
+        moveSegments_t() {
+            items = 0;
+            count = 0;
+            slot = -1;
+        }
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        void clear() { count = 0; }
+        void resize(size_t n) { count = (int)n; } // only for shrinking
+        // The profiles are built to fit (see above, and bendOntoArc for arcs), so running out of room is a
+        // bug. It stops debug builds, and is reported rather than writing past the slot otherwise.
+        bool push_back(const segment& s) {
+            assert(count < capacity);
+            if ( count >= capacity ) {
+                printf("Move has more than %d segments, the rest are left out!\n", (int)capacity);
+                return false;
+            }
+            items[count++] = s;
+            return true;
+        }
+
+        segment& operator[](size_t i) { return items[i]; }
+        const segment& operator[](size_t i) const { return items[i]; }
+        segment& back() { return items[count-1]; }
+        segment* begin() { return items; }
+        segment* end() { return items + count; }
+    };
+
+    typedef moveSegments_t<scv_float> moveSegments;
+
     // A single point to point movement
-    struct move {
+    template <typename F>
+    struct move_t {
+        typedef vec3_t<F> vec3;
+
         vec3 src;
         vec3 dst;
 
+        // A move can follow a circular arc in the XY plane instead of a straight line. The arc goes from
+        // src to dst around arcCenter (whose z is not used), turning by arcAngle radians, anticlockwise
+        // when positive as seen from above. Z changes in step with the angle, so with a change in Z the
+        // arc is a helix. If src and dst are at different distances from the center, the radius changes
+        // smoothly from one to the other. An arcAngle of zero is a straight move. The speed along an arc
+        // is also held down by the acceleration and jerk needed to go around it (see getMoveLimits).
+        // Arcs of up to 45 degrees usually stay within about 0.04% of their radius of the true arc, and
+        // longer ones should be split up (as loadGCodeFile does), since each move only has room for so
+        // many segments. Arcs are never corner blended, but where an arc carries straight on into the next
+        // move the path keeps moving through the join, even without junction speeds (except in streaming
+        // mode). Use junction speeds with a maxVelocityJump to also run through joins that turn slightly.
+        vec3 arcCenter;
+        F arcAngle;
+
+        // Time to stay still at src, for a move whose dst is the same as its src (eg. a G4 in G-code).
+        // Such a move is a single segment at rest, and the moves either side of it stop there. It is
+        // ignored for a move that goes somewhere.
+        F dwell;
+
         // constraints on the movement
-        scv_float vel;
-        scv_float acc;
-        scv_float jerk;
+        F vel;
+        F acc;
+        F jerk;
         cornerBlendType blendType;
-        scv_float blendClearance;
+        F blendClearance;
 
-        std::vector<segment> segments;
+        moveSegments_t<F> segments;
 
 
-        scv_float scaler = 0;
+        F scaler = 0;
 
-        scv_float duration;
-        scv_float scheduledTime;
+        F duration;
+        F scheduledTime;
         int traversal_segmentIndex;
-        scv_float traversal_segmentTime;
-
-        move() {
-            src = vec3_zero;
-            dst = vec3_zero;
+        F traversal_segmentTime;
+
+        // Speed at the start and end of the move, set by calculateMoves. These are zero unless junction
+        // speeds are used (see planner::setJunctionSpeeds), or the move joins an arc that carries on.
+        F entryVel;
+        F exitVel;
+
+        move_t() {
+            src = vec3(0, 0, 0);
+            dst = vec3(0, 0, 0);
+            arcCenter = vec3(0, 0, 0);
+            arcAngle = 0;
+            dwell = 0;
             vel = 0;
             acc = 0;
             jerk = 0;
             blendType = CBT_MAX_JERK;
             blendClearance = -1; // none
+            entryVel = 0;
+            exitVel = 0;
+        }
+    };
+
+    typedef move_t<scv_float> move;
+
+    // A corner blend worked out by planner::planCorner, ready to be applied to the moves either side
+    template <typename F>
+    struct cornerBlend_t {
+        typedef vec3_t<F> vec3;
+
+        bool valid;         // false if the corner can't be blended
+        vec3 startPoint;    // where the blend leaves the linear section of the move before the corner
+        vec3 endPoint;      // where the blend joins the linear section of the move after the corner
+        vec3 v0;            // velocity at the start of the blend
+        vec3 j;             // jerk of the first half of the blend (the second half is -j)
+        F T;        // duration of each half of the blend
+
+        cornerBlend_t() {
+            valid = false;
+        }
+    };
+
+    typedef cornerBlend_t<scv_float> cornerBlend;
+
+    // The length of a move and its limits along its direction, for working out junction speeds
+    template <typename F>
+    struct moveLimits_t {
+        F length;
+        F vel;
+        F acc;
+        F jerk;
+    };
+
+    typedef moveLimits_t<scv_float> moveLimits;
+
+    // The inputs of a move as they were when it was last calculated, for finding which moves have
+    // been edited since then
+    template <typename F>
+    struct moveInputs_t {
+        typedef vec3_t<F> vec3;
+        typedef move_t<F> move;
+
+        bool valid;
+        vec3 src;
+        vec3 dst;
+        vec3 arcCenter;
+        F arcAngle;
+        F dwell;
+        F vel;
+        F acc;
+        F jerk;
+        cornerBlendType blendType;
+        F blendClearance;
+        F scaler;
+
+        moveInputs_t() {
+            valid = false;
+        }
+
+        moveInputs_t(const move& m) {
+            valid = true;
+            src = m.src;
+            dst = m.dst;
+            arcCenter = m.arcCenter;
+            arcAngle = m.arcAngle;
+            dwell = m.dwell;
+            vel = m.vel;
+            acc = m.acc;
+            jerk = m.jerk;
+            blendType = m.blendType;
+            blendClearance = m.blendClearance;
+            scaler = m.scaler;
+        }
+
+        bool matches(const move& m) const {
+            return valid && src.x == m.src.x && src.y == m.src.y && src.z == m.src.z &&
+                   dst.x == m.dst.x && dst.y == m.dst.y && dst.z == m.dst.z &&
+                   arcCenter.x == m.arcCenter.x && arcCenter.y == m.arcCenter.y && arcAngle == m.arcAngle &&
+                   dwell == m.dwell && vel == m.vel && acc == m.acc && jerk == m.jerk &&
+                   blendType == m.blendType && blendClearance == m.blendClearance && scaler == m.scaler;
+        }
+    };
+
+    typedef moveInputs_t<scv_float> moveInputs;
+
+    // Caller-provided output buffers for planner::sampleUniform, with room for 'capacity' samples.
+    // Any of the pointers can be left null if that value is not needed.
+    template <typename F>
+    struct sampleBuffers_t {
+        typedef vec3Array_t<F> vec3Array;
+
+        size_t capacity;
+        double* time;
+        vec3Array pos;
+        vec3Array vel;
+        vec3Array acc;
+        vec3Array jerk;
+        F* scaler;
+        int* segmentIndex;
+        int* moveOwner;
+        int* consecutiveNumber;
+
+        sampleBuffers_t() {
+            capacity = 0;
+            time = 0;
+            scaler = 0;
+            segmentIndex = 0;
+            moveOwner = 0;
+            consecutiveNumber = 0;
         }
     };
 
-    class planner
+    typedef sampleBuffers_t<scv_float> sampleBuffers;
+
+    // Called by planner::sampleUniform each time the buffers are full, and once more at the end
+    // for any remaining samples. The first 'count' entries of each buffer are valid.
+    template <typename F>
+    using sampleCallback_t = void (*)(const sampleBuffers_t<F>& buffers, size_t count, void* userData);
+
+    typedef sampleCallback_t<scv_float> sampleCallback;
+
+    // Scaler at time t into a segment with info 'si', where the position is pos. A scaler that is not a
+    // polynomial is measured from scalerSrc, the start of the segment's scaler move.
+    template <typename F>
+    F evaluateSegmentScaler(const segmentInfo_t<F>& si, F t, const vec3_t<F>& pos, const vec3_t<F>& scalerSrc);
+
+    // Samples row 'row' of 'segments', which runs from segmentStart to segmentEnd, at the times t0 + k * dt
+    // from k = first, until the end of the segment (or after every sample given if it is the last one) or
+    // maxRun samples. The samples are written to 'out' from index 'count', with segmentIndex as their
+    // segment index and scalerSrc as in evaluateSegmentScaler. Returns the number of samples taken. This
+    // is the sampling for both planner::sampleUniform and runGCodeJob, so the two always agree.
+    template <typename F>
+    size_t sampleSegmentRun(const segmentTable_t<F>& segments, size_t row, double segmentStart, double segmentEnd, bool isLast, const vec3_t<F>& scalerSrc, int segmentIndex,
+                            double t0, double dt, size_t first, size_t maxRun, sampleBuffers_t<F>& out, size_t count);
+
+    // Called by the planner in streaming mode (see planner::beginStream) each time the segments of a
+    // move are final. 'segments' holds only the segments of that move, the first of which starts at
+    // 'startTime'. The moveOwner and consecutiveNumber in the segment info count from the start of the
+    // stream. The table is reused for the next move, so anything needed later must be copied out.
+    template <typename F>
+    using streamCallback_t = void (*)(const segmentTable_t<F>& segments, double startTime, void* userData);
+
+    typedef streamCallback_t<scv_float> streamCallback;
+
+    template <typename F>
+    class planner_t
     {
+    public:
+        typedef F scalar;
+        typedef vec3_t<F> vec3;
+        typedef vec3Array_t<F> vec3Array;
+        typedef segment_t<F> segment;
+        typedef segmentInfo_t<F> segmentInfo;
+        typedef segmentTable_t<F> segmentTable;
+        typedef moveSegments_t<F> moveSegments;
+        typedef move_t<F> move;
+        typedef cornerBlend_t<F> cornerBlend;
+        typedef moveLimits_t<F> moveLimits;
+        typedef moveInputs_t<F> moveInputs;
+        typedef sampleBuffers_t<F> sampleBuffers;
+        typedef sampleCallback_t<F> sampleCallback;
+        typedef streamCallback_t<F> streamCallback;
+
     public: // Typically these would be private, they are public here for convenience in the visualizer
+
+        // Everything the planner keeps is allocated from this arena, which gets its memory from the
+        // resource given to the constructor. Small blocks are pooled and reused, and the buffer a
+        // container has outgrown goes back upstream straight away (a monotonic arena kept every one of
+        // them, which more than tripled the peak for a long path). The containers keep their capacity
+        // between calculations, so once the path has been calculated recalculating it (or replanning
+        // after an edit) doesn't allocate at all. This must be declared before the containers that use it.
+        std::pmr::unsynchronized_pool_resource arena;
+
         cornerBlendMethod blendMethod;
         vec3 posLimitLower;
         vec3 posLimitUpper;
@@ -83,59 +402,217 @@ namespace scv {
         vec3 accLimit;
         vec3 jerkLimit;
 
-        std::vector<move> moves;
-        std::vector<segment> segments;
+        std::pmr::vector<move> moves;
+        std::pmr::vector<segment> segmentPool;  // the segments of each move, see moveSegments
+        std::pmr::vector<int> freeSlots;        // slots in segmentPool that no move is using
+        segmentTable segments;
+        std::pmr::vector<double> segmentStartTimes; // cumulative start time of each segment, plus the total time as the last entry
+        std::pmr::vector<double> segmentStartDistances; // cumulative path length at the start of each segment, plus the total length as the last entry (built on demand)
+
+        int lookup_segmentIndex;    // segment found by the most recent hinted lookup
+
+        // Moves ordered by scheduled start time, for finding the moves active at a given time when using
+        // CBM_INTERPOLATED_MOVES. moveEndMax[k] is the latest end time of the first k+1 moves in this order.
+        std::pmr::vector<int> moveOrder;
+        std::pmr::vector<F> moveStartTimes;
+        std::pmr::vector<F> moveEndMax;
+        F interpolatedEndTime;  // latest end time of any move
+        std::pmr::vector<int> activeMoves;   // scratch space for getTrajectoryState_interpolatedMoves
 
         int traversal_segmentIndex;
-        scv_float traversal_segmentTime;
+        F traversal_segmentTime;
 
         vec3 traversal_pos;
-        scv_float traversal_time;
-
-        void calculateMove(move& m);
+        F traversal_time;
+        int traversal_firstMove;    // moves before this one have already finished (CBM_INTERPOLATED_MOVES)
+
+        // Fixed step traversal counts whole ticks of fixedStep_dt. The segment boundaries are converted to
+        // ticks once. Within a segment the position is either stepped by forward differences seeded at the
+        // first tick, or (fixedStep_exact) evaluated from the number of ticks since the segment started.
+        double fixedStep_dt;
+        bool fixedStep_exact;
+        long long fixedStep_tick;               // number of steps taken since resetTraverse_fixedStep
+        int fixedStep_segmentIndex;             // segment of the current tick, or -1 if it needs finding
+        long long fixedStep_segmentEndTick;     // first tick after the current segment, or 0 if it needs finding
+        std::pmr::vector<long long> fixedStep_startTicks;   // first tick in each segment, plus the first tick after the end as the last entry (built on demand)
+        std::pmr::vector<double> fixedStep_phase;           // time from the start of each segment to its first tick
+        double fixedStep_diff[4][3];            // position and its first three forward differences, per axis
+        double fixedStep_coef[4][3];            // cubic coefficients of the current segment, per axis (fixedStep_exact only)
+
+        // Streaming mode keeps only the few moves that can still change in 'moves'. Move indices in the
+        // segment info count from the start of the stream, and moves[0] is move number stream_firstMove.
+        // This is always zero when not streaming.
+        bool streaming;
+        streamCallback stream_callback;
+        void* stream_userData;
+        int stream_firstMove;
+        int stream_numBlended;          // moves before this one in 'moves' have had the corner before them blended
+        int stream_segmentId;           // consecutiveNumber for the next segment
+        F stream_scalerStart;   // scaler value at the end of the last move given out
+        double stream_time;             // start time of the next segment given out
+
+        // For recalculating only the moves that changed since the last calculateMoves. replan_inputs
+        // has one entry per move, and an invalid entry marks a move that must be recalculated. The
+        // limits and blend method used last time are kept too, since changing those affects every move.
+        std::pmr::vector<moveInputs> replan_inputs;
+        std::pmr::vector<int> moveFirstSegment;     // index in 'segments' of the first segment of each move, plus the total as the last entry
+        cornerBlendMethod replan_blendMethod;
+        vec3 replan_velLimit;
+        vec3 replan_accLimit;
+        vec3 replan_jerkLimit;
+        bool replan_junctionSpeeds;     // junction speeds were worked out last time
+        int replan_shiftedFrom;     // first move whose index has changed since the last calculateMoves, or -1 if none
+        std::pmr::vector<std::pair<size_t, size_t> > replan_ranges; // scratch space for replanChangedMoves
+        segmentTable replan_rows;                                   // scratch space for replanMoves
+
+        // Scratch space for calculating the whole path, kept so that it doesn't need allocating every time
+        std::pmr::vector<cornerBlend> calc_corners;     // corner i is between moves i-1 and i
+        std::pmr::vector<F> calc_speeds;        // junction speed before each move, plus one for the end
+        std::pmr::vector<moveLimits> calc_limits;
+        std::pmr::vector<int> calc_firstIds;            // consecutiveNumber of the first segment of each move
+
+        int numThreads;             // threads used by calculateMoves, zero for one per core
+
+        bool junctionSpeeds;        // let the path run through junctions without stopping (see setJunctionSpeeds)
+        F junctionMaxJump;  // largest instant change of velocity allowed at a junction
+
+        void giveSegmentSlot(move& m);
+        void freeSegmentSlot(move& m);
+        void assignAllSegmentSlots();
+        bool checkGlobalLimits();
+        void getMoveLimits(const move& m, F* v, F* a, F* j);
+        void getArcLimits(const move& m, F* v, F* a, F* j);
+        void calculateMove(move& m, F entryVel = 0, F exitVel = 0);
+        void calculateMoveBatch(size_t first, size_t count);
+        void appendMoveProfile(move& m, F v, F j, F T1, F TL, F T2);
+        void straightenArcMove(move& m);
+        bool usesJunctionSpeeds();
+        void calculateJunctionSpeeds();
         void calculateSchedules();
+        void buildMoveIndex();
+        int findActiveMoves(F t);
+        bool planCorner(const move& m0, const move& m1, bool isFirst, bool isLast, cornerBlend& b);
         void blendCorner(move& m0, move& m1, bool isFirst, bool isLast);
         void collateSegments();
-        void calculateScalars();
-        void tagScalars();
-        void planner::getSegmentState(segment& s, scv_float t, vec3* pos, vec3* vel, vec3* acc, vec3* jerk, scv_float* scaler);
+        void collateMove(segmentTable& table, size_t row, size_t moveInd, int firstId, F scalerStart);
+        void updateSegmentStartTimes(size_t first);
+        bool canReplan();
+        bool replanChangedMoves();
+        bool replanMoves(size_t first, size_t last);
+        void recordReplanInputs();
+        void replaceMoves(size_t first, size_t count, const move* newMoves, size_t numNewMoves);
+        bool canMergeMoves(size_t first, size_t last, F tolerance);
+        void getSegmentState(int segmentInd, F t, vec3* pos, vec3* vel, vec3* acc, vec3* jerk, F* scaler);
+        void getSegmentEndState(int segmentInd, vec3* pos, vec3* vel, vec3* acc, vec3* jerk, F* scaler);
+        void getSegmentStateBatch(int segmentInd, const F* t, size_t n, vec3Array pos, vec3Array vel, vec3Array acc);
+        F getSegmentScaler(int segmentInd, F t, const vec3& pos);
+        int findSegmentIndex(double t);
+        int findSegmentIndex(double t, int hint);
+        void buildDistanceTable();
+        double getSegmentArcLength(int segmentInd, double t);
+        double getSegmentTimeAtArcLength(int segmentInd, double s);
+        bool getTrajectoryStateAtSegment(int segmentInd, double t, int* segmentIndex, vec3* pos, vec3* vel, vec3* acc, vec3* jerk, F* scaler, int* mOwner, int* sconse);
         //void getSegmentPosition(segment& s, double t, scv::vec3* pos);
-        std::vector<segment>& getSegments();
+        segmentTable& getSegments();
+
+        bool advanceTraverse_constantJerkSegments(F dt, vec3* p);
+        void buildTickTable();
+        bool seedTraverse_fixedStep(vec3* p);
+        bool advanceTraverse_interpolatedMoves(F dt, vec3* p);
 
-        bool advanceTraverse_constantJerkSegments(scv_float dt, vec3* p);
-        bool advanceTraverse_interpolatedMoves(scv_float dt, vec3* p);
+        F getTraverseTime_constantJerkSegments();
+        F getTraverseTime_interpolatedMoves();
 
-        scv_float getTraverseTime_constantJerkSegments();
-        scv_float getTraverseTime_interpolatedMoves();
+        void advanceStream(bool isEnd);
+        void emitStreamMove();
 
     // The actual public part would normally start from here
     public:
-        planner();
+        // The planner allocates everything from 'upstream' by way of its own arena. A fixed buffer can be
+        // given (eg. a std::pmr::monotonic_buffer_resource over a static array) to avoid the heap entirely.
+        planner_t(std::pmr::memory_resource* upstream = std::pmr::get_default_resource());
 
-        void clear();
+        void clear();   // removes all moves, and gives the memory back to the upstream resource
 
         void setCornerBlendMethod(cornerBlendMethod m);
 
-        void setPositionLimits(scv_float lx, scv_float ly, scv_float lz, scv_float ux, scv_float uy, scv_float uz);
-        void setVelocityLimits(scv_float x, scv_float y, scv_float z);
-        void setAccelerationLimits(scv_float x, scv_float y, scv_float z);
-        void setJerkLimits(scv_float x, scv_float y, scv_float z);
+        void setPositionLimits(F lx, F ly, F lz, F ux, F uy, F uz);
+        void setVelocityLimits(F x, F y, F z);
+        void setAccelerationLimits(F x, F y, F z);
+        void setJerkLimits(F x, F y, F z);
+
+        // Number of threads calculateMoves can use when calculating the whole path, or zero for one per
+        // core. The default is one. The result is exactly the same for any number of threads.
+        void setNumThreads(int n);
+
+        // By default every move starts and ends at rest, and only blended corners keep the path moving.
+        // With junction speeds enabled, the path can also run straight through the junction between two
+        // moves, which helps a lot with long runs of short moves (eg. curves in G-code). Each junction is
+        // given the highest speed that every move can still reach and slow down from within its length,
+        // by a backward and a forward pass over the moves. A junction that changes direction would need an
+        // instant change of velocity, so this is only allowed up to maxVelocityJump (the magnitude of the
+        // change), which is zero by default so that only straight-through junctions keep moving. Corners
+        // that can be blended are still blended, and the moves either side of them start and end at rest.
+        // Joins where an arc carries straight on keep moving whether this is enabled or not. Junction
+        // speeds are not used for CBM_INTERPOLATED_MOVES, or in streaming mode, and while they are used
+        // (including for any arcs) an edit to any move makes calculateMoves recalculate everything.
+        void setJunctionSpeeds(bool enable, F maxVelocityJump = 0);
 
         void appendMove( move& l );
         bool calculateMoves();
-        bool planner::getTrajectoryState_constantJerkSegments(scv_float t, int* segmentIndex, vec3* pos, vec3* vel, vec3* acc, vec3* jerk, scv_float* scaler, scv_float tconst = 0.002, int* mOwner = 0, int* sconse = 0);
-        bool getTrajectoryState_interpolatedMoves(scv_float time, int *segmentIndex, vec3* pos, vec3* vel, vec3* acc, vec3* jerk );
 
-        scv_float getTraverseTime();
+        // Editing the list of moves. The moves on either side are joined up to the changed part, ie. the
+        // src of each move is the dst of the move before it. After any edits (including changing the
+        // fields of moves directly), calculateMoves only recalculates the moves that changed and the
+        // corners either side of them, and patches the existing segments.
+        void insertMove(size_t index, move& m);
+        void eraseMove(size_t index);
+        void replaceMoves(size_t first, size_t count, const std::vector<move>& newMoves);
+
+        // Merges runs of consecutive moves that have the same limits and blend settings into single moves,
+        // wherever the points between them are all within 'tolerance' of the merged move. Slicers often
+        // give long runs of tiny, almost straight moves, which plan much faster (and into far fewer
+        // segments) once merged. The scaler of each point removed must also be within the same tolerance
+        // of where the merged move would reach that scaler value, so eg. the extrusion along the path is
+        // kept. Returns the number of moves removed. Use before calculateMoves, as everything is
+        // recalculated afterwards.
+        size_t simplifyMoves(F tolerance);
+
+        // Streaming mode, for paths too long to hold in memory at once. Between beginStream and endStream,
+        // appendMove calculates each move as it is added, and the segments of each move are given to the
+        // callback as soon as they can no longer change. A corner blend only affects the two moves on
+        // either side of it, so only the last few moves are kept. calculateMoves is not used in this mode,
+        // and CBM_INTERPOLATED_MOVES is not supported. A move can't keep going into the next without the
+        // moves after that, so arcs stop at both ends here, even where they carry straight on.
+        bool beginStream(streamCallback callback, void* userData = 0);
+        void endStream();
+        bool getTrajectoryState_constantJerkSegments(F t, int* segmentIndex, vec3* pos, vec3* vel, vec3* acc, vec3* jerk, F* scaler, F tconst = 0.002, int* mOwner = 0, int* sconse = 0);
+        bool getTrajectoryStateHinted_constantJerkSegments(F t, int* segmentIndex, vec3* pos, vec3* vel, vec3* acc, vec3* jerk, F* scaler, int* mOwner = 0, int* sconse = 0);
+        bool getTrajectoryState_interpolatedMoves(F time, int *segmentIndex, vec3* pos, vec3* vel, vec3* acc, vec3* jerk );
+
+        size_t sampleUniform(double dt, double t0, double t1, sampleBuffers& out, sampleCallback callback = 0, void* userData = 0);
+
+        F getTraverseTime();
+
+        // Path length along the constant jerk segments. These convert between time and distance
+        // travelled, eg. for looking up a laser power or extrusion amount by distance.
+        double getTraverseDistance();
+        double getDistanceAtTime(double t);
+        double getTimeAtDistance(double s);
 
         void resetTraverse();
-        bool advanceTraverse(scv_float dt, vec3* p);
+        bool advanceTraverse(F dt, vec3* p);
+
+        void resetTraverse_fixedStep(double dt, bool exact = false);
+        bool advanceTraverse_fixedStep(vec3* p);
 
         void printConstraints();    // print global limits for each axis
         void printMoves();          // print input parameters for each point to point move
         void printSegments();       // print calculated parameters for each segment
     };
 
+    typedef planner_t<scv_float> planner;
+
 } // namespace
 
 #endif
@@ -7,16 +7,17 @@ namespace scv {
 
     // dir must be normalized
     // lim is a positive upper bound (octant of a cube)
-    vec3 getBoundedVector(vec3 dir, vec3 lim) {
+    template <typename T>
+    vec3_t<T> getBoundedVector(vec3_t<T> dir, vec3_t<T> lim) {
 
         int yneg = dir.y < 0 ? -1 : 1;
         int xneg = dir.x < 0 ? -1 : 1;
         int zneg = dir.z < 0 ? -1 : 1;
         
         dir = abs(dir);
-        vec3 v = lim.Length() * dir;
+        vec3_t<T> v = lim.Length() * dir;
 
-        scv_float f = 1;
+        T f = 1;
         if ( v.x != 0 )
             f = min(f, lim.x / v.x);
         if ( v.y != 0 )
@@ -27,7 +28,10 @@ namespace scv {
         if ( f < 1 )
             v *= f;
 
-        return vec3( xneg * v.x, yneg * v.y, zneg * v.z );
+        return vec3_t<T>( xneg * v.x, yneg * v.y, zneg * v.z );
     }
 
+    template vec3_t<float> getBoundedVector(vec3_t<float> dir, vec3_t<float> lim);
+    template vec3_t<double> getBoundedVector(vec3_t<double> dir, vec3_t<double> lim);
+
 }
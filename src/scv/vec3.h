@@ -1,26 +1,35 @@
-
 #ifndef SCV_VEC3_H
 #define SCV_VEC3_H
 
 #include <math.h>
+#include <stddef.h>
 
+// The precision used by the plain (non-template) names like vec3 and planner. Both float and double
+// versions of everything are built, eg. planner_t<double>, so this only picks the default.
 #define scv_float       float
 
 namespace scv {
 
-    struct vec3
+    template <typename T>
+    struct vec3_t
     {
-        scv_float x, y, z;
+        typedef T scalar;
+
+        T x, y, z;
+
+        vec3_t() {}
 
-        vec3() {}
+        vec3_t(T x, T y, T z) : x(x), y(y), z(z) {}
 
-        vec3(scv_float x, scv_float y, scv_float z) : x(x), y(y), z(z) {}
+        // Conversion from the other precision
+        template <typename U>
+        explicit vec3_t(const vec3_t<U>& v) : x((T)v.x), y((T)v.y), z((T)v.z) {}
 
         void SetZero() { x = 0.0; y = 0.0; z = 0.0; }
 
-        void Set(scv_float x_, scv_float y_, scv_float z_) { x = x_; y = y_; z = z_; }
+        void Set(T x_, T y_, T z_) { x = x_; y = y_; z = z_; }
 
-        scv_float& operator[] (size_t i)
+        T& operator[] (size_t i)
         {
             switch (i) {
             case 0: return x;
@@ -30,34 +39,34 @@ namespace scv {
             }
         }
 
-        vec3 operator -() const { vec3 v; v.Set(-x, -y, -z); return v; }
+        vec3_t operator -() const { vec3_t v; v.Set(-x, -y, -z); return v; }
 
-        void operator += (const vec3& v)
+        void operator += (const vec3_t& v)
         {
             x += v.x; y += v.y; z += v.z;
         }
 
-        void operator -= (const vec3& v)
+        void operator -= (const vec3_t& v)
         {
             x -= v.x; y -= v.y; z -= v.z;
         }
 
-        bool operator == (const vec3& b)
+        bool operator == (const vec3_t& b)
         {
             return x == b.x && y == b.y && z == b.z;
         }
 
-        void operator *= (scv_float a)
+        void operator *= (T a)
         {
             x *= a; y *= a; z *= a;
         }
 
-        scv_float Length() const
+        T Length() const
         {
-            return (scv_float)sqrt(x * x + y * y + z * z);
+            return (T)sqrt(x * x + y * y + z * z);
         }
 
-        scv_float LengthSquared() const
+        T LengthSquared() const
         {
             return x * x + y * y + z * z;
         }
@@ -67,12 +76,12 @@ namespace scv {
             return x == 0 || y == 0 || z == 0;
         }
 
-        scv_float Normalize()
+        T Normalize()
         {
-            scv_float length = Length();
+            T length = Length();
             if (length < 0.00000001)
                 return 0.0;
-            scv_float invLength = 1.0f / length;
+            T invLength = (T)1 / length;
             x *= invLength;
             y *= invLength;
             z *= invLength;
@@ -81,44 +90,76 @@ namespace scv {
         }
     };
 
+    typedef vec3_t<scv_float> vec3;
+
     extern const vec3 vec3_zero;
 
-    inline scv_float dot(const vec3& a, const vec3& b)
+    // Pointers to separate x/y/z arrays, for structure-of-arrays style buffers
+    template <typename T>
+    struct vec3Array_t
+    {
+        T *x, *y, *z;
+
+        vec3Array_t() : x(0), y(0), z(0) {}
+
+        vec3Array_t(T* x, T* y, T* z) : x(x), y(y), z(z) {}
+
+        bool isNull() const { return x == 0; }
+
+        void set(size_t i, const vec3_t<T>& v) { x[i] = v.x; y[i] = v.y; z[i] = v.z; }
+
+        vec3_t<T> get(size_t i) const { return vec3_t<T>(x[i], y[i], z[i]); }
+
+        // View of the same arrays starting from entry i
+        vec3Array_t offset(size_t i) const { return isNull() ? *this : vec3Array_t(x + i, y + i, z + i); }
+    };
+
+    typedef vec3Array_t<scv_float> vec3Array;
+
+    template <typename T>
+    inline T dot(const vec3_t<T>& a, const vec3_t<T>& b)
     {
         return a.x * b.x + a.y * b.y + a.z * b.z;
     }
 
-    inline vec3 cross(vec3 v1, vec3 v2)
+    template <typename T>
+    inline vec3_t<T> cross(vec3_t<T> v1, vec3_t<T> v2)
     {
-        return vec3(
+        return vec3_t<T>(
             v1.y * v2.z - v1.z * v2.y,
             v1.z * v2.x - v1.x * v2.z,
             v1.x * v2.y - v1.y * v2.x
         );
     }
 
-    inline vec3 operator + (const vec3& a, const vec3& b)
+    template <typename T>
+    inline vec3_t<T> operator + (const vec3_t<T>& a, const vec3_t<T>& b)
     {
-        return vec3(a.x + b.x, a.y + b.y, a.z + b.z);
+        return vec3_t<T>(a.x + b.x, a.y + b.y, a.z + b.z);
     }
 
-    inline vec3 operator * (const vec3& a, const vec3& b)
+    template <typename T>
+    inline vec3_t<T> operator * (const vec3_t<T>& a, const vec3_t<T>& b)
     {
-        return vec3(a.x * b.x, a.y * b.y, a.z * b.z);
+        return vec3_t<T>(a.x * b.x, a.y * b.y, a.z * b.z);
     }
 
-    inline vec3 operator - (const vec3& a, const vec3& b)
+    template <typename T>
+    inline vec3_t<T> operator - (const vec3_t<T>& a, const vec3_t<T>& b)
     {
-        return vec3(a.x - b.x, a.y - b.y, a.z - b.z);
+        return vec3_t<T>(a.x - b.x, a.y - b.y, a.z - b.z);
     }
 
-    inline vec3 operator * (scv_float s, const vec3& a)
+    // The scalar is converted to the precision of the vector (it is not used to deduce T)
+    template <typename T>
+    inline vec3_t<T> operator * (typename vec3_t<T>::scalar s, const vec3_t<T>& a)
     {
-        return vec3(s * a.x, s * a.y, s * a.z);
+        return vec3_t<T>(s * a.x, s * a.y, s * a.z);
     }
 
-    inline vec3 abs(const vec3& v) {
-        return vec3( (scv_float)fabs(v.x), (scv_float)fabs(v.y), (scv_float)fabs(v.z));
+    template <typename T>
+    inline vec3_t<T> abs(const vec3_t<T>& v) {
+        return vec3_t<T>( (T)fabs(v.x), (T)fabs(v.y), (T)fabs(v.z));
     }
 
     template <typename T>
@@ -127,9 +168,10 @@ namespace scv {
         return a < b ? a : b;
     }
 
-    inline vec3 min(const vec3& a, const vec3& b)
+    template <typename T>
+    inline vec3_t<T> min(const vec3_t<T>& a, const vec3_t<T>& b)
     {
-        return vec3(min(a.x, b.x), min(a.y, b.y), min(a.z, b.z));
+        return vec3_t<T>(min(a.x, b.x), min(a.y, b.y), min(a.z, b.z));
     }
 
     template <typename T>
@@ -138,12 +180,15 @@ namespace scv {
         return a > b ? a : b;
     }
 
-    inline vec3 max(const vec3& a, const vec3& b)
+    template <typename T>
+    inline vec3_t<T> max(const vec3_t<T>& a, const vec3_t<T>& b)
     {
-        return vec3(max(a.x, b.x), max(a.y, b.y), max(a.z, b.z));
+        return vec3_t<T>(max(a.x, b.x), max(a.y, b.y), max(a.z, b.z));
     }
 
-    vec3 getBoundedVector(vec3 dir, vec3 lim);
+    // Built for float and double in vec3.cpp
+    template <typename T>
+    vec3_t<T> getBoundedVector(vec3_t<T> dir, vec3_t<T> lim);
 
 }
 
@@ -15,6 +15,8 @@
 #include <chrono>
 #include "implot.h"
 #include "planner.h"
+#include "gcode.h"
+#include "pipeline.h"
 #include "camera.h"
 
 using namespace std;
@@ -25,7 +27,6 @@ using namespace scv;
 #endif
 
 #include <fstream>
-#include <sstream>
 #include <filesystem>
 
 GLFWwindow* window;
@@ -154,6 +155,73 @@ bool violation(vec3& p, vec3& j, vec3& dp, vec3& dv, vec3& da) {
     return false;
 }
 
+// Buffers and running state used to draw the path from chunks of uniformly spaced samples
+#define PATHSAMPLEDT 0.01
+#define PATHCHUNK 1024
+double pathTime[PATHCHUNK];
+scv_float pathPosX[PATHCHUNK], pathPosY[PATHCHUNK], pathPosZ[PATHCHUNK];
+scv_float pathVelX[PATHCHUNK], pathVelY[PATHCHUNK], pathVelZ[PATHCHUNK];
+scv_float pathAccX[PATHCHUNK], pathAccY[PATHCHUNK], pathAccZ[PATHCHUNK];
+scv_float pathJerkX[PATHCHUNK], pathJerkY[PATHCHUNK], pathJerkZ[PATHCHUNK];
+int pathSegment[PATHCHUNK];
+
+struct pathDrawState {
+    int count;      // samples processed so far
+    vec3 lp, lv, la; // previous sample, to check the rate of change
+    vec3 vp;        // location of the last violation found
+};
+
+void drawPathChunk(const sampleBuffers& b, size_t n, void* userData) {
+
+    pathDrawState& state = *(pathDrawState*)userData;
+
+    for (size_t i = 0; i < n; i++) {
+        int count = state.count;
+        vec3 p = b.pos.get(i);
+        vec3 v = b.vel.get(i);
+        vec3 a = b.acc.get(i);
+        vec3 j = b.jerk.get(i);
+
+        vec3 dp = p - state.lp;
+        vec3 dv = v - state.lv;
+        vec3 da = a - state.la;
+
+        if ( count > 0 && violation(p, j, dp, dv, da) ) {
+            haveViolation = true;
+            state.vp = p;
+        }
+
+        vec3 c = colors[scv::max(0, b.segmentIndex[i]) % 3];
+        glColor3f(c.x,c.y,c.z);
+
+        glVertex3f( p.x, p.y, p.z );
+
+        if ( count < MAXPLOTPOINTS ) {
+            plotTime[count] = (float)b.time[i];
+            plotPosX[count] = p.x;
+            plotPosY[count] = p.y;
+            plotPosZ[count] = p.z;
+            plotVelX[count] = v.x;
+            plotVelY[count] = v.y;
+            plotVelZ[count] = v.z;
+            plotAccX[count] = a.x;
+            plotAccY[count] = a.y;
+            plotAccZ[count] = a.z;
+            plotJerkX[count] = j.x;
+            plotJerkY[count] = j.y;
+            plotJerkZ[count] = j.z;
+            plotVelMag[count] = v.Length();
+            plotAccMag[count] = a.Length();
+            plotJerkMag[count] = j.Length();
+        }
+
+        state.count++;
+        state.lp = p;
+        state.lv = v;
+        state.la = a;
+    }
+}
+
 // This function will be called during ImGui's rendering, while drawing the background.
 // Draw all our stuff here so the GUI windows will then be over the top of it. Need to
 // re-enable scissor test after we're done.
@@ -165,7 +233,7 @@ void backgroundRenderCallback(const ImDrawList* parent_list, const ImDrawCmd* cm
 
     haveViolation = false;
 
-    // calculate the trajectory every frame, and measure the time taken
+    // calculate the trajectory every frame (only edited moves are actually recalculated), and measure the time taken
     std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
     plan.calculateMoves();
     plan.calculateSchedules();
@@ -218,77 +286,29 @@ void backgroundRenderCallback(const ImDrawList* parent_list, const ImDrawCmd* cm
     glPointSize(4);
     glBegin(GL_POINTS);
 
-    vec3 p, v, a, j; // position, velocity, acceleration, jerk
-    vec3 lp, lv, la;
-    
-    p = vec3_zero;
-    v = vec3_zero;
-    a = vec3_zero;
-    
-	lp = p;
-	lv = v;
-	la = a;
-    
-    scv_float t = 0;
-    int count = 0;
-    int segmentIndex;
-    scv_float e;
-    while ( true ) {
-
-        if ( t > 0.7 ) {
-            int adf = 3;
-            adf += 2;
-        }
-
-        bool stillOnPath = false;
-        if ( plan.blendMethod == CBM_INTERPOLATED_MOVES )
-            stillOnPath = plan.getTrajectoryState_interpolatedMoves(t, &segmentIndex, &p, &v, &a, &j);
-        else
-            stillOnPath = plan.getTrajectoryState_constantJerkSegments(t, &segmentIndex, &p, &v, &a, &j, &e);
-
-        vec3 dp = p - lp;
-        vec3 dv = v - lv;
-        vec3 da = a - la;
-
-        if ( count > 0 && violation(p, j, dp, dv, da) ) {
-            haveViolation = true;
-            vp = p;
-        }
-
-        vec3 c = colors[segmentIndex % 3];
-        glColor3f(c.x,c.y,c.z);
-
-        glVertex3f( p.x, p.y, p.z );
-
-        if ( count < MAXPLOTPOINTS ) {
-            plotTime[count] = t;
-            plotPosX[count] = p.x;
-            plotPosY[count] = p.y;
-            plotPosZ[count] = p.z;
-            plotVelX[count] = v.x;
-            plotVelY[count] = v.y;
-            plotVelZ[count] = v.z;
-            plotAccX[count] = a.x;
-            plotAccY[count] = a.y;
-            plotAccZ[count] = a.z;
-            plotJerkX[count] = j.x;
-            plotJerkY[count] = j.y;
-            plotJerkZ[count] = j.z;
-            plotVelMag[count] = v.Length();
-            plotAccMag[count] = a.Length();
-            plotJerkMag[count] = j.Length();
-        }
-
-        t += 0.01f;
-        count++;
-
-        if ( ! stillOnPath )
-            break;
-
-        lp = p;
-        lv = v;
-        la = a;
-    }
+    pathDrawState state;
+    state.count = 0;
+    state.lp = vec3_zero;
+    state.lv = vec3_zero;
+    state.la = vec3_zero;
+    state.vp = vec3_zero;
+
+    sampleBuffers buffers;
+    buffers.capacity = PATHCHUNK;
+    buffers.time = pathTime;
+    buffers.pos = vec3Array(pathPosX, pathPosY, pathPosZ);
+    buffers.vel = vec3Array(pathVelX, pathVelY, pathVelZ);
+    buffers.acc = vec3Array(pathAccX, pathAccY, pathAccZ);
+    buffers.jerk = vec3Array(pathJerkX, pathJerkY, pathJerkZ);
+    buffers.segmentIndex = pathSegment;
+
+    // sample up to the first time step at or beyond the end of the path
+    double endTime = ceil(plan.getTraverseTime() / PATHSAMPLEDT) * PATHSAMPLEDT;
+    plan.sampleUniform(PATHSAMPLEDT, 0, endTime, buffers, drawPathChunk, &state);
+
+    int count = state.count;
+    if ( haveViolation )
+        vp = state.vp;
 
     /*size_t segmentIndex = 0;
     float timeBase = 0;
@@ -558,6 +578,36 @@ void loadTestCase_malformed() {
     plan.resetTraverse();
 }
 
+// arcs whose radius changes along the way, as G2/G3 lines with an I/J that doesn't match their end make
+// them (the G-code reader now sends these straight, so they are given to the planner directly)
+void loadTestCase_spirals() {
+    plan.clear();
+    plan.setPositionLimits(0, -5, 0, 110, 55, 10);
+
+    scv::move m;
+    m.vel = 200;
+    m.acc = 2000;
+    m.jerk = 50000;
+    m.blendType = CBT_MAX_JERK;
+    m.src = vec3(0, 0, 0);
+    m.dst = vec3(10, 0, 0);                 plan.appendMove(m);
+    // G2 X10 Y2.5 I1 J0, radius 1 to 2.69
+    m.arcCenter = vec3(11, 0, 0);
+    m.arcAngle = -1.1902899f;
+    m.dst = vec3(10, 2.5f, 0);              plan.appendMove(m);
+    m.arcAngle = 0;
+    m.dst = vec3(99.564f, 47.026f, 0);      plan.appendMove(m);
+    // G2 X83.646 Y47.635 I1 J0, radius 1 to 16.9
+    m.arcCenter = vec3(100.564f, 47.026f, 0);
+    m.arcAngle = -0.0359859f;
+    m.dst = vec3(83.646f, 47.635f, 0);      plan.appendMove(m);
+
+    plan.calculateMoves();
+    plan.resetTraverse();
+}
+
+float gcodeSimplifyTolerance = 0; // merge almost straight runs of G-code moves, zero to keep every move
+
 void loadTestCase_file(const std::filesystem::path filename)
 {
 
@@ -570,12 +620,6 @@ void loadTestCase_file(const std::filesystem::path filename)
     //auto filename = std::filesystem::absolute(Reffilename); // Convert to absolute path
     plan.clear();
     //plan.setPositionLimits(0, 0, 0, 10, 10, 7);
-    std::ifstream file(filename);
-    if (!file)
-    {
-        printf("Failed to open GCode file: %s\n", filename.string().c_str());
-        return;
-    }
     scv::move m;
     m.vel = 1000000000; //this is the current feed rate
     m.acc = 1000000000;
@@ -583,78 +627,25 @@ void loadTestCase_file(const std::filesystem::path filename)
     m.blendType = CBT_MAX_JERK;
     m.scaler = 0;
     m.src = vec3(0, 0, 0);
-    m.dst = vec3(0, 0, 0);  plan.appendMove(m);
-    bool newMove = false;
-    bool isMove = false;
-    std::string line;
-    size_t moveCount = 0;
-    vec3 newPos = vec3_zero;
-    while (std::getline(file, line))
-    {
-        std::istringstream iss(line);
-        std::string token;
-
-        while (iss >> token)
-        {
-            if (token[0] == 'G')
-            {
-                if (token == "G0")
-                    isMove = true;
-                if (token == "G1")
-                    isMove = true;
-            }
-            if (isMove)
-            {
-                if (token[0] == 'X')
-                {
-                    newPos.x = std::stof(token.substr(1));
-                    newMove = true;
-                }
-                else if (token[0] == 'Y')
-                {
-                    newPos.y = std::stof(token.substr(1));
-                    newMove = true;
-                }
-                else if (token[0] == 'Z')
-                {
-                    newPos.z = std::stof(token.substr(1));
-                    newMove = true;
-                }
-                else if (token[0] == 'E')
-                {
-                    //this is the extruded amount
-                    m.scaler = std::stof(token.substr(1));
-                    newMove = true;
-                }
-                else if (token[0] == 'F')
-                {
-                    //This is the feed rate
-                    m.vel = std::stof(token.substr(1));
-                }
-            }
-        }
-
-        if (newMove && isMove)
-        {
-            m.dst = newPos;
-            plan.appendMove(m);
-            //printf("Move Aded");
-            moveCount++;
-        }
-        newMove = false;
-        isMove = false;
-        //m.scaler = 0;
-        //m.extrudeLength = 0;
-
-        printf("Move count %d\n", moveCount);
-        if (moveCount == 1000)
-        {
-            break;
-        }
+    m.dst = vec3(0, 0, 0);
 
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<scv::move> gcodeMoves;
+    if ( ! loadGCodeFile(filename.string().c_str(), m, gcodeMoves, 0) )
+    {
+        printf("Failed to open GCode file: %s\n", filename.string().c_str());
+        return;
+    }
+    plan.appendMove(m);
+    for (scv::move& gm : gcodeMoves)
+        plan.appendMove(gm);
+    auto t1 = std::chrono::steady_clock::now();
+    printf("Read %d moves from %s in %.1f ms\n", (int)gcodeMoves.size(), filename.string().c_str(), std::chrono::duration<double, std::milli>(t1 - t0).count());
+
+    if ( gcodeSimplifyTolerance > 0 ) {
+        size_t removed = plan.simplifyMoves(gcodeSimplifyTolerance);
+        printf("Simplifying removed %d of %d moves\n", (int)removed, (int)(removed + plan.moves.size()));
     }
-
-    file.close();
 
     plan.calculateMoves();
     plan.resetTraverse();
@@ -664,6 +655,24 @@ void loadTestCase_file(const std::filesystem::path filename)
 
 bool trajectorySaved = false;
 
+// Buffers used to export the trajectory in chunks
+#define EXPORTSAMPLEDT 0.002
+#define EXPORTCHUNK 4096
+double exportTime[EXPORTCHUNK];
+scv_float exportPosX[EXPORTCHUNK], exportPosY[EXPORTCHUNK], exportPosZ[EXPORTCHUNK];
+scv_float exportScaler[EXPORTCHUNK];
+int exportSegment[EXPORTCHUNK], exportMoveOwner[EXPORTCHUNK], exportConsecutive[EXPORTCHUNK];
+
+void writeTrajectoryChunk(const sampleBuffers& b, size_t count, void* userData)
+{
+    std::ofstream& file = *(std::ofstream*)userData;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (b.segmentIndex[i] >= 0)
+            file << b.segmentIndex[i] << "\t" << b.time[i] << "\t" << b.pos.x[i] << "\t" << b.pos.y[i] << "\t" << b.pos.z[i] << "\t" << b.scaler[i] << "\t" << b.moveOwner[i] << "\t" << b.consecutiveNumber[i] << "\n";
+    }
+}
+
 void saveTrajectoryToFile(const std::string& filename)
 {
     std::ofstream file(filename);
@@ -675,40 +684,69 @@ void saveTrajectoryToFile(const std::string& filename)
 
     file << "Time,X,Y,Z,E\n"; // CSV header
 
-    scv_float t = 0;
-    int count = 0;
-    vec3 v, a, j;
-    vec3 p;
-    scv_float e = 0, e_old = 0;
-    int segmentIndex, old_segmentIndex = 0;
-    int mOwner, sConsec = 0;
+    sampleBuffers buffers;
+    buffers.capacity = EXPORTCHUNK;
+    buffers.time = exportTime;
+    buffers.pos = vec3Array(exportPosX, exportPosY, exportPosZ);
+    buffers.scaler = exportScaler;
+    buffers.segmentIndex = exportSegment;
+    buffers.moveOwner = exportMoveOwner;
+    buffers.consecutiveNumber = exportConsecutive;
 
-    while (true)
-    {
-        bool stillOnPath = false;
-        if (plan.blendMethod == CBM_INTERPOLATED_MOVES)
-            stillOnPath = plan.getTrajectoryState_interpolatedMoves(t, &segmentIndex, &p, &v, &a, &j);
-        else
-            stillOnPath = plan.getTrajectoryState_constantJerkSegments(t, &segmentIndex, &p, &v, &a, &j, &e, 0.002,  &mOwner, &sConsec);
+    // sample up to the first time step at or beyond the end of the path
+    double endTime = ceil(plan.getTraverseTime() / EXPORTSAMPLEDT) * EXPORTSAMPLEDT;
+    plan.sampleUniform(EXPORTSAMPLEDT, 0, endTime, buffers, writeTrajectoryChunk, &file);
 
-        if (old_segmentIndex != segmentIndex)
-        {
-            old_segmentIndex = segmentIndex;
-            //e_old = 0;
-        }
+    file.close();
+    printf("Trajectory saved to %s\n", filename.c_str());
+}
 
-        if(segmentIndex >= 0)
-            file << segmentIndex << "\t" << t << "\t" << p.x << "\t" << p.y << "\t" << p.z << "\t" << e << "\t" << mOwner << "\t" << sConsec << "\n";
+// Reads, plans and saves a G-code file in one pass, with the same limits as loadTestCase_file. The file
+// is not loaded for display, and the three steps overlap so that files too big to hold in memory can
+// be exported in about the time of the slowest step.
+void exportGCodeFile(const std::filesystem::path filename, const std::string& outFilename, cornerBlendMethod blendMethod)
+{
+    std::ofstream file(outFilename);
+    if (!file.is_open())
+    {
+        printf("Error: Could not open file %s for writing!\n", outFilename.c_str());
+        return;
+    }
 
-        e_old = e;
-        t += 0.002; // Keep in sync with rendering step
+    file << "Time,X,Y,Z,E\n"; // CSV header
 
-        if (!stillOnPath)
-            break;
-    }
+    planner exportPlan;
+    exportPlan.setCornerBlendMethod(blendMethod);
+    exportPlan.setPositionLimits(0, 0, 0, 200, 200, 100);
+    exportPlan.setVelocityLimits(250, 35, 35);
+    exportPlan.setAccelerationLimits(1000, 25, 25);
+    exportPlan.setJerkLimits(100000, 10000, 10000);
+
+    gcodeJob job;
+    job.base.vel = 1000000000;
+    job.base.acc = 1000000000;
+    job.base.jerk = 1000000000;
+    job.base.blendType = CBT_MAX_JERK;
+    job.sampleDt = EXPORTSAMPLEDT;
+
+    sampleBuffers buffers;
+    buffers.capacity = EXPORTCHUNK;
+    buffers.time = exportTime;
+    buffers.pos = vec3Array(exportPosX, exportPosY, exportPosZ);
+    buffers.scaler = exportScaler;
+    buffers.segmentIndex = exportSegment;
+    buffers.moveOwner = exportMoveOwner;
+    buffers.consecutiveNumber = exportConsecutive;
+
+    std::string name = filename.string();
+    job.filename = name.c_str();
+    auto t0 = std::chrono::steady_clock::now();
+    if ( ! runGCodeJob(exportPlan, job, buffers, writeTrajectoryChunk, &file) )
+        printf("Failed to export GCode file: %s\n", name.c_str());
+    auto t1 = std::chrono::steady_clock::now();
 
     file.close();
-    printf("Trajectory saved to %s\n", filename.c_str());
+    printf("Trajectory of %s saved to %s in %.1f ms\n", name.c_str(), outFilename.c_str(), std::chrono::duration<double, std::milli>(t1 - t0).count());
 }
 
 void loadTestCase_pnp() {
@@ -791,6 +829,7 @@ int main(int, char**)
 
     cornerBlendMethod blendMethod = CBM_CONSTANT_JERK_SEGMENTS;
     plan.setCornerBlendMethod(blendMethod);
+    plan.setNumThreads(0); // use all cores when the whole path is recalculated
 
     plan.setVelocityLimits(20, 20, 20);
     plan.setAccelerationLimits(100, 100, 100);
@@ -806,6 +845,8 @@ int main(int, char**)
     bool stopOnViolation = false;
     bool doRandomizePoints = false;
     float animSpeedScale = 1;
+    bool useJunctionSpeeds = false;
+    float junctionMaxJump = 0;
 
     while (!glfwWindowShouldClose(window))
     {
@@ -908,6 +949,10 @@ int main(int, char**)
                 blendMethod =(cornerBlendMethod)e;
                 plan.setCornerBlendMethod(blendMethod);
 
+                ImGui::Checkbox("Junction speeds", &useJunctionSpeeds);
+                ImGui::SliderFloat("Max velocity jump", &junctionMaxJump, 0, 5);
+                plan.setJunctionSpeeds(useJunctionSpeeds, junctionMaxJump);
+
                 if (ImGui::TreeNode("Hard limits per axis")) {
                     ImGui::SeparatorText("Position constraint");
                     showVec3Editor("Pos", &plan.posLimitUpper);
@@ -960,15 +1005,26 @@ int main(int, char**)
                     doRandomizePoints = false;
                     loadTestCase_malformed();
                 } ImGui::SameLine();
+                if (ImGui::Button("Spirals"))
+                {
+                    doRandomizePoints = false;
+                    loadTestCase_spirals();
+                } ImGui::SameLine();
                 if (ImGui::Button("GCode"))
                 {
                     auto gcodeFile = std::filesystem::path("UM3E_3DBenchy.gcode");
                     loadTestCase_file(gcodeFile);
                 } ImGui::SameLine();
+                if (ImGui::Button("GCode export"))
+                {
+                    auto gcodeFile = std::filesystem::path("UM3E_3DBenchy.gcode");
+                    exportGCodeFile(gcodeFile, "output.txt", blendMethod);
+                } ImGui::SameLine();
                 if (ImGui::Button("PNP")) {
                     doRandomizePoints = false;
                     loadTestCase_pnp();
                 }
+                ImGui::SliderFloat("GCode simplify tolerance", &gcodeSimplifyTolerance, 0, 0.1f);
 
                 ImGui::Checkbox("Randomize points", &doRandomizePoints);
                 ImGui::Checkbox("Stop on violation", &stopOnViolation);
@@ -1058,6 +1114,7 @@ int main(int, char**)
                 ImGui::Text("Violation: %s", haveViolation ? "yes":"no");
                 ImGui::Text("Num segments: %d",(int)plan.getSegments().size());
                 ImGui::Text("Traverse time: %.2f",plan.getTraverseTime());
+                ImGui::Text("Path length: %.2f",plan.getTraverseDistance());
                 ImGui::Text("Average framerate: %.1f fps)", io.Framerate);
             }
 